@@ -2,9 +2,14 @@
 
 #include "dc_bias.hpp"
 #include "../ease.hpp"
+#include "../fft.hpp"
 #include "../misc.hpp"
+#include "../sliding_window.hpp"
+#include "../thread_pool.hpp"
+#include <atomic>
+#include <cassert>
 #include <chrono>
-#include <numeric>
+#include <thread>
 #include <vector>
 
 namespace snd {
@@ -45,6 +50,42 @@ struct cycle_info {
 	size_t dive_pos;
 };
 
+namespace detail {
+
+static constexpr auto SPECTRAL_MIN_FREQ = 20.0f;
+
+// The longest period the spectral mode looks for
+[[nodiscard]] inline
+auto spectral_max_lag(size_t SR) -> size_t {
+	return std::max(size_t(4), size_t(float(SR) / SPECTRAL_MIN_FREQ));
+}
+
+// Frames between the starts of consecutive spectral windows
+[[nodiscard]] inline
+auto spectral_hop(size_t SR) -> size_t {
+	return std::max(size_t(64), spectral_max_lag(SR) / 4);
+}
+
+struct spectral_scratch {
+	size_t SR      = 0;
+	size_t min_lag = 0;
+	size_t max_lag = 0;
+	size_t window  = 0;
+	size_t hop     = 0;
+	fft::real_plan plan;
+	std::vector<float> a;
+	std::vector<float> b;
+	std::vector<fft::complex> A;
+	std::vector<fft::complex> B;
+	std::vector<float> diff;
+};
+
+} // detail
+
+// Scratch space for an analysis. Reusing one work object for
+// many analyses (e.g. one per worker thread, see thread_work)
+// avoids reallocating: every buffer keeps its capacity between
+// runs.
 struct work {
 	struct {
 		std::vector<float> raw;
@@ -54,6 +95,10 @@ struct work {
 	std::vector<poka::cycle_info> cycle_info;
 	std::vector<poka::range> cycle_range;
 	std::vector<size_t> cycle_best_match;
+	std::vector<float> dc_window_midpoints;
+	// The period estimated for each hop, in spectral mode
+	std::vector<float> spectral_periods;
+	detail::spectral_scratch spectral;
 };
 
 struct output {
@@ -62,11 +107,66 @@ struct output {
 	} frames;
 };
 
+// Typical cycles per second, only used to guess how much room
+// to reserve for the cycles of a sample
+static constexpr auto RESERVE_CYCLE_FREQ = 500.0f;
+
+// Empties work for an analysis of n frames without giving back
+// any memory, and reserves room for all the frames and a
+// reasonable guess at the number of cycles so that there is
+// little or no reallocation while it runs. The analysis
+// functions call this themselves.
+inline
+auto prepare(poka::work* work, size_t n, size_t SR) -> void {
+	const auto cycles = size_t(float(n) * RESERVE_CYCLE_FREQ / float(std::max(size_t(1), SR)));
+	work->frames.raw.clear();
+	work->frames.smoothed.clear();
+	work->frames.estimated_size.clear();
+	work->cycle_info.clear();
+	work->cycle_range.clear();
+	work->cycle_best_match.clear();
+	work->dc_window_midpoints.clear();
+	work->spectral_periods.clear();
+	work->frames.raw.reserve(n);
+	work->frames.smoothed.reserve(n);
+	work->frames.estimated_size.reserve(n);
+	work->cycle_info.reserve(cycles);
+	work->cycle_range.reserve(cycles);
+	work->cycle_best_match.reserve(cycles);
+	work->spectral_periods.reserve((n / detail::spectral_hop(SR)) + 1);
+}
+
+// Gives back all the memory held by work
+inline
+auto release(poka::work* work) -> void {
+	*work = poka::work{};
+}
+
+// A work object for the calling thread, for batch analysis on
+// worker threads. It grows to fit the longest sample analysed
+// on that thread so far; call release() on it after a big
+// batch if that matters.
+[[nodiscard]] inline
+auto thread_work() -> poka::work& {
+	thread_local poka::work work;
+	return work;
+}
+
 enum class result { ok, aborted };
-enum class mode { milestones, classic };
+// How multi-channel frames are laid out in the get_frames buffer
+enum class layout { interleaved, planar };
+// milestones and classic compare cycles found at zero
+// crossings. spectral estimates the local period from a
+// windowed YIN-style difference function computed with FFTs
+// every hop, which copes better with noisy or inharmonic
+// material and doesn't depend on the number of cycles.
+enum class mode { milestones, classic, spectral };
 
 namespace detail {
 
+// Estimated size when there is nothing to go on
+static constexpr auto DEFAULT_SIZE = 44100.0f;
+
 static constexpr auto WORK_COST_READ_FRAMES     = 1;
 static constexpr auto WORK_COST_REMOVE_DC_BIAS  = 8;
 static constexpr auto WORK_COST_PRE_SMOOTH      = 200;
@@ -79,11 +179,19 @@ static constexpr auto WORK_COST_TOTAL =
 	WORK_COST_AUTOCORRELATION + WORK_COST_WRITE_SIZES + WORK_COST_REMOVE_DC_BIAS +
 	WORK_COST_POST_SMOOTH;
 
+// Per-frame stages run in chunks of this many frames, with an
+// abort check and a progress update per chunk
+static constexpr auto STAGE_CHUNK_SIZE = size_t(4096);
+// report_progress is only called when progress has moved on by
+// at least this fraction of the total since the last call
+static constexpr auto PROGRESS_RESOLUTION = 0.001f;
+
 template <typename ReportProgressFn>
 struct progress_reporter {
 	ReportProgressFn report_progress;
-	float total_work = 0.0f;
-	float work_done  = 0.0f;
+	float total_work  = 0.0f;
+	float work_done   = 0.0f;
+	float next_report = 0.0f;
 };
 
 template <typename ReportProgressFn>
@@ -99,23 +207,34 @@ auto add_work_to_do(progress_reporter<ReportProgressFn>* reporter, float work) -
 template <typename ReportProgressFn>
 auto complete_work(progress_reporter<ReportProgressFn>* reporter, float work) -> void {
 	reporter->work_done += work;
+	if (reporter->work_done >= reporter->next_report) {
+		reporter->next_report = reporter->work_done + (reporter->total_work * PROGRESS_RESOLUTION);
+		reporter->report_progress(reporter->work_done / reporter->total_work);
+	}
+}
+
+// Reports whatever was held back by the throttling
+template <typename ReportProgressFn>
+auto flush_progress(progress_reporter<ReportProgressFn>* reporter) -> void {
+	reporter->next_report = reporter->work_done + (reporter->total_work * PROGRESS_RESOLUTION);
 	reporter->report_progress(reporter->work_done / reporter->total_work);
 }
 
-template <size_t BufferSize, typename CB> inline
-auto read_frames(poka::work* work, CB cb, size_t n) -> void {
-	work->frames.raw.resize(n);
-	size_t frames_remaining = n;
-	size_t frame_read_index = 0;
-	for (;;) {
-		size_t frames_to_read = std::min(frames_remaining, BufferSize);
-		cb.get_frames(frame_read_index, frames_to_read, work->frames.raw.data() + frame_read_index);
-		frames_remaining -= frames_to_read;
-		frame_read_index += frames_to_read;
-		if (frames_remaining == 0) {
-			return;
+template <size_t BufferSize, typename CB, typename ProgressReporter> [[nodiscard]] inline
+auto read_frames(poka::work* work, CB cb, ProgressReporter* progress_reporter, size_t n) -> bool {
+	// Grown a chunk at a time (into reserved memory, see
+	// prepare) so that the whole buffer isn't zeroed up front
+	work->frames.raw.clear();
+	for (size_t beg = 0; beg < n; beg += BufferSize) {
+		if (cb.should_abort()) {
+			return false;
 		}
+		const auto count = std::min(n - beg, BufferSize);
+		work->frames.raw.resize(beg + count);
+		cb.get_frames(beg, count, work->frames.raw.data() + beg);
+		complete_work(progress_reporter, (float(count) / n) * WORK_COST_READ_FRAMES);
 	}
+	return true;
 }
 
 inline
@@ -133,48 +252,62 @@ auto add_cycle(poka::work* work, size_t idx, poka::range range, size_t dive_pos)
 			info.nadir.pos   = i;
 		}
 	}
-	work->cycle_info.resize(idx + 1);
-	work->cycle_range.resize(idx + 1);
-	work->cycle_best_match.resize(idx + 1);
-	work->cycle_info[idx]  = info;
-	work->cycle_range[idx] = range;
-	work->cycle_best_match[idx] = range.end;
+	assert(idx == work->cycle_info.size());
+	work->cycle_info.push_back(info);
+	work->cycle_range.push_back(range);
+	work->cycle_best_match.push_back(range.end);
 }
 
-template <typename ProgressReporter>
-auto find_cycles(poka::work* work, ProgressReporter* progress_reporter) -> void {
+struct find_cycles_state {
 	static constexpr auto MIN_CYCLE_LEN = 2;
-	const auto frame_count = work->frames.smoothed.size();
-	bool init = false;
-	bool up_flag = true;
+	bool init       = false;
+	bool up_flag    = true;
 	size_t cycle_beg = 0;
 	size_t cycle_idx = 0;
-	size_t dive_pos = 0;
-	for (size_t i = 0; i < frame_count; i++) {
-		bool just_crossed    = false;
-		const auto value     = work->frames.smoothed[i];
-		const auto value_up  = value > 0;
-		const auto cycle_len = i - cycle_beg;
-		if (!up_flag && value_up) {
-			up_flag = true;
-			if (cycle_len >= MIN_CYCLE_LEN) {
-				just_crossed = true;
-			}
+	size_t dive_pos  = 0;
+};
+
+inline
+auto find_cycles_step(poka::work* work, find_cycles_state* s, size_t i) -> void {
+	bool just_crossed    = false;
+	const auto value     = work->frames.smoothed[i];
+	const auto value_up  = value > 0;
+	const auto cycle_len = i - s->cycle_beg;
+	if (!s->up_flag && value_up) {
+		s->up_flag = true;
+		if (cycle_len >= find_cycles_state::MIN_CYCLE_LEN) {
+			just_crossed = true;
 		}
-		if (up_flag && !value_up) {
-			up_flag  = false;
-			dive_pos = i;
+	}
+	if (s->up_flag && !value_up) {
+		s->up_flag  = false;
+		s->dive_pos = i;
+	}
+	if (just_crossed) {
+		if (s->init) {
+			add_cycle(work, s->cycle_idx, {s->cycle_beg, i}, s->dive_pos);
+			s->cycle_idx++;
 		}
-		if (just_crossed) {
-			if (init) {
-				add_cycle(work, cycle_idx, {cycle_beg, i}, dive_pos);
-				cycle_idx++;
-			}
-			cycle_beg = i;
-			init = true;
+		s->cycle_beg = i;
+		s->init = true;
+	}
+}
+
+template <typename ShouldAbortFn, typename ProgressReporter> [[nodiscard]]
+auto find_cycles(poka::work* work, ShouldAbortFn should_abort, ProgressReporter* progress_reporter) -> bool {
+	const auto frame_count = work->frames.smoothed.size();
+	find_cycles_state state;
+	for (size_t beg = 0; beg < frame_count; beg += STAGE_CHUNK_SIZE) {
+		if (should_abort()) {
+			return false;
+		}
+		const auto end = std::min(frame_count, beg + STAGE_CHUNK_SIZE);
+		for (size_t i = beg; i < end; i++) {
+			find_cycles_step(work, &state, i);
 		}
-		complete_work(progress_reporter, (1.0f / frame_count) * WORK_COST_FIND_CYCLES);
+		complete_work(progress_reporter, (float(end - beg) / frame_count) * WORK_COST_FIND_CYCLES);
 	}
+	return true;
 }
 
 [[nodiscard]] inline
@@ -219,61 +352,88 @@ auto make_context(const poka::work& work, size_t beg, size_t end) -> poka::range
 	return { cycle_beg_range.beg, cycle_end_sub_1_range.end };
 }
 
-inline
-auto remove_dc_bias(poka::work* work, size_t window_size) -> void {
-	audio::dc_bias::detection detection;
-	audio::dc_bias::const_frames const_frames{work->frames.raw.data(), work->frames.raw.size()};
-	audio::dc_bias::frames frames{work->frames.raw.data(), work->frames.raw.size()};
-	audio::dc_bias::detect(const_frames, window_size, &detection);
-	audio::dc_bias::apply_correction(frames, detection);
+template <typename ShouldAbortFn, typename ProgressReporter> [[nodiscard]]
+auto remove_dc_bias(poka::work* work, ShouldAbortFn should_abort, ProgressReporter* progress_reporter, size_t window_size) -> bool {
+	namespace dc_bias = audio::dc_bias;
+	const auto size = work->frames.raw.size();
+	const auto const_frames = dc_bias::const_frames{work->frames.raw.data(), size};
+	const auto frames       = dc_bias::frames{work->frames.raw.data(), size};
+	auto& midpoints = work->dc_window_midpoints;
+	midpoints.clear();
+	for (size_t beg = 0; beg < size; beg += window_size) {
+		if (should_abort()) {
+			return false;
+		}
+		midpoints.push_back(dc_bias::detail::detect_midpoint(const_frames, window_size, {beg, std::min(size, beg + window_size)}));
+	}
+	complete_work(progress_reporter, WORK_COST_REMOVE_DC_BIAS * 0.5f);
+	for (size_t beg = 0; beg < size; beg += STAGE_CHUNK_SIZE) {
+		if (should_abort()) {
+			return false;
+		}
+		const auto end = std::min(size, beg + STAGE_CHUNK_SIZE);
+		dc_bias::apply_correction(frames, midpoints, window_size, beg, end);
+		complete_work(progress_reporter, (float(end - beg) / size) * WORK_COST_REMOVE_DC_BIAS * 0.5f);
+	}
+	return true;
 }
 
-[[nodiscard]] inline
-auto smooth_value(const std::vector<float>& in, size_t index, size_t window_size) -> float {
-	const auto window_beg = size_t(std::max(0, int(index) - int(window_size)));
-	const auto window_end = size_t(std::min(in.size(), index + window_size));
-	const auto sum = std::accumulate(in.begin() + window_beg, in.begin() + window_end, 0.0f);
-	return sum / float(window_end - window_beg);
+template <typename ShouldAbortFn, typename ProgressReporter> [[nodiscard]]
+auto smooth(const std::vector<float>& in, ShouldAbortFn should_abort, ProgressReporter* progress_reporter, size_t window_size, float work_cost, std::vector<float>* out) -> bool {
+	const auto size = in.size();
+	out->clear();
+	out->reserve(size);
+	for (size_t beg = 0; beg < size; beg += STAGE_CHUNK_SIZE) {
+		if (should_abort()) {
+			return false;
+		}
+		const auto end = std::min(size, beg + STAGE_CHUNK_SIZE);
+		out->resize(end);
+		sliding_window::centered_mean(in.data(), size, window_size, beg, end, out->data());
+		complete_work(progress_reporter, (float(end - beg) / size) * work_cost);
+	}
+	return true;
 }
 
-template <typename ProgressReporter>
-auto pre_smooth(poka::work* work, ProgressReporter* progress_reporter, size_t window_size) -> void {
-	work->frames.smoothed.resize(work->frames.raw.size());
+template <typename ShouldAbortFn, typename ProgressReporter> [[nodiscard]]
+auto pre_smooth(poka::work* work, ShouldAbortFn should_abort, ProgressReporter* progress_reporter, size_t window_size) -> bool {
 	if (work->frames.raw.size() < window_size) {
-		std::copy(work->frames.raw.begin(), work->frames.raw.end(), work->frames.smoothed.begin());
-		return;
-	}
-	for (size_t i = 0; i < work->frames.raw.size(); i++) {
-		work->frames.smoothed[i] = smooth_value(work->frames.raw, i, window_size);
-		complete_work(progress_reporter, (1.0f / work->frames.raw.size()) * WORK_COST_PRE_SMOOTH);
+		work->frames.smoothed = work->frames.raw;
+		return true;
 	}
+	return smooth(work->frames.raw, should_abort, progress_reporter, window_size, WORK_COST_PRE_SMOOTH, &work->frames.smoothed);
 }
 
-template <typename ProgressReporter>
-auto post_smooth(const poka::work& work, ProgressReporter* progress_reporter, size_t window_size, poka::output* out) -> void {
-	out->frames.estimated_size.resize(work.frames.raw.size());
+template <typename ShouldAbortFn, typename ProgressReporter> [[nodiscard]]
+auto post_smooth(const poka::work& work, ShouldAbortFn should_abort, ProgressReporter* progress_reporter, size_t window_size, poka::output* out) -> bool {
 	if (work.frames.raw.size() < window_size) {
-		std::copy(work.frames.estimated_size.begin(), work.frames.estimated_size.end(), out->frames.estimated_size.begin());
-		return;
-	}
-	for (size_t i = 0; i < work.frames.raw.size(); i++) {
-		out->frames.estimated_size[i] = smooth_value(work.frames.estimated_size, i, window_size);
-		complete_work(progress_reporter, (1.0f / work.frames.raw.size()) * WORK_COST_POST_SMOOTH);
+		out->frames.estimated_size = work.frames.estimated_size;
+		return true;
 	}
+	return smooth(work.frames.estimated_size, should_abort, progress_reporter, window_size, WORK_COST_POST_SMOOTH, &out->frames.estimated_size);
 }
 
-template <typename ProgressReporter> inline
-auto write_estimated_sizes(poka::work* work, ProgressReporter* progress_reporter) -> void {
-	work->frames.estimated_size.resize(work->frames.raw.size());
+[[nodiscard]] inline
+auto cycle_size(const poka::work& work, size_t cycle_idx) -> float {
+	return float(work.cycle_best_match[cycle_idx] - work.cycle_range[cycle_idx].beg);
+}
+
+template <typename ShouldAbortFn, typename ProgressReporter> [[nodiscard]] inline
+auto write_estimated_sizes(poka::work* work, ShouldAbortFn should_abort, ProgressReporter* progress_reporter) -> bool {
+	// Grown a cycle at a time, like the raw frames
+	work->frames.estimated_size.clear();
 	// Beginning
 	{
 		const auto cycle_range      = work->cycle_range.front();
 		const auto cycle_best_match = work->cycle_best_match.front();
 		const auto size             = float(cycle_best_match - cycle_range.beg);
-		std::fill(work->frames.estimated_size.begin(), work->frames.estimated_size.begin() + cycle_range.end, size);
+		work->frames.estimated_size.resize(cycle_range.end, size);
 	}
 	// Middle
 	for (size_t i = 1; i < work->cycle_info.size() - 1; i++) {
+		if (should_abort()) {
+			return false;
+		}
 		const auto& cycle_best_match_a = work->cycle_best_match[i-1];
 		const auto& cycle_best_match_b = work->cycle_best_match[i-0];
 		const auto& cycle_range_a      = work->cycle_range[i-1];
@@ -281,6 +441,7 @@ auto write_estimated_sizes(poka::work* work, ProgressReporter* progress_reporter
 		const auto cycle_range_b_len   = float(cycle_range_b.end - cycle_range_b.beg);
 		const auto size_a              = float(cycle_best_match_a - cycle_range_a.beg);
 		const auto size_b              = float(cycle_best_match_b - cycle_range_b.beg);
+		work->frames.estimated_size.resize(cycle_range_b.end);
 		for (size_t j = cycle_range_b.beg; j < cycle_range_b.end; j++) {
 			const auto t                   = float(j - cycle_range_b.beg) / cycle_range_b_len;
 			work->frames.estimated_size[j] = lerp(size_a, size_b, t);
@@ -292,13 +453,14 @@ auto write_estimated_sizes(poka::work* work, ProgressReporter* progress_reporter
 		const auto cycle_range      = work->cycle_range.back();
 		const auto cycle_best_match = work->cycle_best_match.back();
 		const auto size             = float(cycle_best_match - cycle_range.beg);
+		work->frames.estimated_size.resize(work->frames.raw.size());
 		std::fill(work->frames.estimated_size.begin() + cycle_range.beg, work->frames.estimated_size.end(), size);
 	}
+	return true;
 }
 
 inline
 auto no_cycles(const poka::work& work, poka::output* out) -> void {
-	static constexpr auto DEFAULT_SIZE = 44100.0f;
 	out->frames.estimated_size.resize(work.frames.raw.size());
 	std::fill(out->frames.estimated_size.begin(), out->frames.estimated_size.end(), DEFAULT_SIZE);
 }
@@ -386,61 +548,572 @@ auto milestones_cycle_autocorrelation(poka::work* work, size_t cycle_idx, size_t
 	}
 }
 
+template <mode Mode> inline
+auto cycle_autocorrelation(poka::work* work, size_t cycle_idx, size_t depth) -> void {
+	if constexpr (Mode == mode::milestones) {
+		milestones_cycle_autocorrelation(work, cycle_idx, depth);
+	}
+	else {
+		classic_cycle_autocorrelation(work, cycle_idx, depth);
+	}
+}
+
 template <mode Mode, typename ShouldAbortFn, typename ProgressReporter> [[nodiscard]] inline
 auto autocorrelation(poka::work* work, ShouldAbortFn should_abort, ProgressReporter* progress_reporter, size_t depth) -> bool {
 	for (size_t i = 0; i < work->cycle_info.size(); i++) {
 		if (should_abort()) {
 			return false;
 		}
-		if constexpr (Mode == mode::milestones) {
-			milestones_cycle_autocorrelation(work, i, depth);
+		cycle_autocorrelation<Mode>(work, i, depth);
+		complete_work(progress_reporter, (1.0f / work->cycle_info.size()) * detail::WORK_COST_AUTOCORRELATION);
+	}
+	return true;
+}
+
+static constexpr auto PARALLEL_CYCLE_CHUNK_SIZE = size_t(64);
+
+// Each cycle's score only reads the smoothed frames and the
+// cycle ranges and info, and only writes its own
+// cycle_best_match entry, so the cycles can be scored in any
+// order on any thread and the result is identical to the
+// serial version.
+//
+// should_abort and the progress reporter are only ever
+// called from the calling thread (which also works on
+// chunks). The other threads just watch an atomic flag.
+template <mode Mode, typename ShouldAbortFn, typename ProgressReporter> [[nodiscard]] inline
+auto autocorrelation(poka::work* work, ShouldAbortFn should_abort, ProgressReporter* progress_reporter, size_t depth, th::thread_pool* pool) -> bool {
+	const auto cycle_count   = work->cycle_info.size();
+	const auto caller_thread = std::this_thread::get_id();
+	std::atomic<bool> aborted = false;
+	std::atomic<size_t> cycles_done = 0;
+	size_t cycles_reported = 0;
+	const auto report = [&]() {
+		const auto done = cycles_done.load();
+		complete_work(progress_reporter, (float(done - cycles_reported) / cycle_count) * detail::WORK_COST_AUTOCORRELATION);
+		cycles_reported = done;
+	};
+	pool->parallel_for(cycle_count, PARALLEL_CYCLE_CHUNK_SIZE, [&](size_t beg, size_t end) {
+		const auto is_caller_thread = std::this_thread::get_id() == caller_thread;
+		for (size_t i = beg; i < end; i++) {
+			if (aborted.load(std::memory_order_relaxed)) {
+				return;
+			}
+			if (is_caller_thread && should_abort()) {
+				aborted = true;
+				return;
+			}
+			cycle_autocorrelation<Mode>(work, i, depth);
 		}
-		else {
-			classic_cycle_autocorrelation(work, i, depth);
+		cycles_done += end - beg;
+		if (is_caller_thread) {
+			report();
 		}
-		complete_work(progress_reporter, (1.0f / work->cycle_info.size()) * detail::WORK_COST_AUTOCORRELATION);
+	});
+	if (aborted) {
+		return false;
 	}
+	report();
 	return true;
 }
 
+
+static constexpr auto SPECTRAL_MAX_FREQ  = 4000.0f;
+static constexpr auto SPECTRAL_THRESHOLD = 0.15f;
+static constexpr auto SPECTRAL_PROGRESS_INTERVAL = size_t(64);
+static constexpr auto WORK_COST_SPECTRAL = WORK_COST_FIND_CYCLES + WORK_COST_AUTOCORRELATION + WORK_COST_WRITE_SIZES;
+
+[[nodiscard]] inline
+auto make_spectral_scratch(size_t SR) -> spectral_scratch {
+	spectral_scratch out;
+	out.SR      = SR;
+	out.max_lag = spectral_max_lag(SR);
+	out.min_lag = std::max(size_t(2), size_t(float(SR) / SPECTRAL_MAX_FREQ));
+	out.window  = out.max_lag;
+	out.hop     = spectral_hop(SR);
+	const auto fft_size = fft::next_pow2(out.window + out.max_lag + 1);
+	out.plan = fft::make_real_plan(fft_size);
+	out.a.resize(fft_size);
+	out.b.resize(fft_size);
+	out.A.resize((fft_size / 2) + 1);
+	out.B.resize((fft_size / 2) + 1);
+	out.diff.resize(out.max_lag + 2);
+	return out;
+}
+
+// Returns the period (in frames) of the window starting at
+// beg, or 0 if the window is silent.
+//
+// d(t) = sum_j (x[j] - x[j+t])^2 over the window, expanded to
+// e(0) + e(t) - 2r(t) so that the cross term r(t) can be
+// computed for every lag at once as an FFT correlation.
+[[nodiscard]] inline
+auto spectral_period(const std::vector<float>& x, size_t beg, spectral_scratch* s) -> float {
+	static constexpr auto SILENCE = 1e-9f;
+	const auto W = s->window;
+	const auto L = W + s->max_lag + 1;
+	std::fill(s->a.begin(), s->a.end(), 0.0f);
+	std::fill(s->b.begin(), s->b.end(), 0.0f);
+	const auto available = beg < x.size() ? x.size() - beg : 0;
+	std::copy(x.begin() + beg, x.begin() + beg + std::min(W, available), s->a.begin());
+	std::copy(x.begin() + beg, x.begin() + beg + std::min(L, available), s->b.begin());
+	double e0 = 0.0;
+	for (size_t j = 0; j < W; j++) {
+		e0 += double(s->b[j]) * s->b[j];
+	}
+	if (e0 < SILENCE) {
+		return 0.0f;
+	}
+	fft::real_forward(s->plan, s->a.data(), s->A.data());
+	fft::real_forward(s->plan, s->b.data(), s->B.data());
+	for (size_t k = 0; k < s->A.size(); k++) {
+		s->A[k] = std::conj(s->A[k]) * s->B[k];
+	}
+	// s->a now receives r(t) = sum_j a[j] * b[j + t]
+	fft::real_inverse(s->plan, s->A.data(), s->a.data());
+	// Cumulative mean normalized difference
+	double et = e0;
+	double running = 0.0;
+	s->diff[0] = 1.0f;
+	for (size_t t = 1; t <= s->max_lag; t++) {
+		et += (double(s->b[t + W - 1]) * s->b[t + W - 1]) - (double(s->b[t - 1]) * s->b[t - 1]);
+		const auto d = std::max(0.0, e0 + et - (2.0 * s->a[t]));
+		running += d;
+		s->diff[t] = running > 0.0 ? float(d * double(t) / running) : 1.0f;
+	}
+	auto best = s->min_lag;
+	bool found = false;
+	for (size_t t = s->min_lag; t <= s->max_lag; t++) {
+		if (s->diff[t] < SPECTRAL_THRESHOLD) {
+			while (t + 1 <= s->max_lag && s->diff[t + 1] < s->diff[t]) {
+				t++;
+			}
+			best  = t;
+			found = true;
+			break;
+		}
+	}
+	if (!found) {
+		for (size_t t = s->min_lag; t <= s->max_lag; t++) {
+			if (s->diff[t] < s->diff[best]) {
+				best = t;
+			}
+		}
+	}
+	// Parabolic interpolation around the minimum
+	if (best > s->min_lag && best < s->max_lag) {
+		const auto y0 = s->diff[best - 1];
+		const auto y1 = s->diff[best];
+		const auto y2 = s->diff[best + 1];
+		const auto denom = y0 - (2.0f * y1) + y2;
+		if (std::abs(denom) > 1e-12f) {
+			return float(best) + std::clamp(0.5f * (y0 - y2) / denom, -0.5f, 0.5f);
+		}
+	}
+	return float(best);
+}
+
+// Estimates the period every hop and linearly interpolates
+// between the hop centers to fill work->frames.estimated_size
+template <typename ShouldAbortFn, typename ProgressReporter> [[nodiscard]] inline
+auto spectral_estimate(poka::work* work, ShouldAbortFn should_abort, ProgressReporter* progress_reporter, size_t SR) -> bool {
+	const auto frame_count = work->frames.smoothed.size();
+	auto& sizes = work->frames.estimated_size;
+	sizes.resize(frame_count);
+	if (frame_count == 0) {
+		complete_work(progress_reporter, WORK_COST_SPECTRAL);
+		return true;
+	}
+	auto& scratch = work->spectral;
+	if (scratch.SR != SR) {
+		scratch = make_spectral_scratch(SR);
+	}
+	const auto hop_count = (frame_count + scratch.hop - 1) / scratch.hop;
+	auto& periods = work->spectral_periods;
+	periods.resize(hop_count);
+	for (size_t hop = 0; hop < hop_count; hop++) {
+		if (should_abort()) {
+			return false;
+		}
+		periods[hop] = spectral_period(work->frames.smoothed, hop * scratch.hop, &scratch);
+		if ((hop + 1) % SPECTRAL_PROGRESS_INTERVAL == 0) {
+			complete_work(progress_reporter, (float(SPECTRAL_PROGRESS_INTERVAL) / hop_count) * WORK_COST_SPECTRAL);
+		}
+	}
+	complete_work(progress_reporter, (float(hop_count % SPECTRAL_PROGRESS_INTERVAL) / hop_count) * WORK_COST_SPECTRAL);
+	// Silent hops take the estimate of the previous hop (or the
+	// next one if they are at the start)
+	const auto first_known = std::find_if(periods.begin(), periods.end(), [](float p) { return p > 0.0f; });
+	if (first_known == periods.end()) {
+		std::fill(sizes.begin(), sizes.end(), DEFAULT_SIZE);
+		return true;
+	}
+	std::fill(periods.begin(), first_known, *first_known);
+	for (auto it = first_known; it != periods.end(); it++) {
+		if (*it <= 0.0f) {
+			*it = *(it - 1);
+		}
+	}
+	const auto center = [&scratch](size_t hop) { return (hop * scratch.hop) + (scratch.window / 2); };
+	for (size_t i = 0; i < std::min(frame_count, center(0)); i++) {
+		sizes[i] = periods.front();
+	}
+	for (size_t hop = 0; hop + 1 < hop_count; hop++) {
+		const auto beg = center(hop);
+		const auto end = std::min(frame_count, center(hop + 1));
+		for (size_t i = beg; i < end; i++) {
+			const auto t = float(i - beg) / float(scratch.hop);
+			sizes[i] = lerp(periods[hop], periods[hop + 1], t);
+		}
+	}
+	for (size_t i = center(hop_count - 1); i < frame_count; i++) {
+		sizes[i] = periods.back();
+	}
+	return true;
+}
+
+// What estimate_sizes() left to do
+enum class estimate_result {
+	aborted,
+	// The sizes are in work->frames.estimated_size, ready for
+	// the post smoothing
+	needs_smoothing,
+	// There were too few cycles to go on, so out has been
+	// written directly
+	done,
+};
+
+// Everything after the pre smoothing and before the post
+// smoothing. This part follows the channel's own cycles so
+// it can't be shared between channels.
 template <mode Mode, typename ShouldAbortFn, typename ProgressReporter> [[nodiscard]] inline
-auto autocorrelation(poka::work* work, ShouldAbortFn should_abort, ProgressReporter* progress_reporter, size_t depth, size_t SR, poka::output* out) -> poka::result {
-	if (work->cycle_info.empty()) {
-		no_cycles(*work, out);
-		complete_work(progress_reporter, WORK_COST_AUTOCORRELATION);
-		return poka::result::ok;
+auto estimate_sizes(poka::work* work, ShouldAbortFn should_abort, ProgressReporter* progress_reporter, size_t depth, size_t SR, poka::output* out, th::thread_pool* pool) -> estimate_result {
+	if constexpr (Mode == mode::spectral) {
+		if (!spectral_estimate(work, should_abort, progress_reporter, SR)) {
+			return estimate_result::aborted;
+		}
+		return estimate_result::needs_smoothing;
 	}
-	if (work->cycle_info.size() < 2) {
-		one_cycle(*work, out);
-		complete_work(progress_reporter, WORK_COST_AUTOCORRELATION);
+	else {
+		if (!find_cycles(work, should_abort, progress_reporter)) {
+			return estimate_result::aborted;
+		}
+		if (work->cycle_info.empty()) {
+			no_cycles(*work, out);
+			complete_work(progress_reporter, WORK_COST_AUTOCORRELATION);
+			return estimate_result::done;
+		}
+		if (work->cycle_info.size() < 2) {
+			one_cycle(*work, out);
+			complete_work(progress_reporter, WORK_COST_AUTOCORRELATION);
+			return estimate_result::done;
+		}
+		const auto ok = pool
+			? autocorrelation<Mode>(work, should_abort, progress_reporter, depth, pool)
+			: autocorrelation<Mode>(work, should_abort, progress_reporter, depth);
+		if (!ok) {
+			return estimate_result::aborted;
+		}
+		if (!write_estimated_sizes(work, should_abort, progress_reporter)) {
+			return estimate_result::aborted;
+		}
+		return estimate_result::needs_smoothing;
+	}
+}
+
+template <mode Mode, typename ShouldAbortFn, typename ProgressReporter> [[nodiscard]] inline
+auto analyse(poka::work* work, ShouldAbortFn should_abort, ProgressReporter* progress_reporter, size_t depth, size_t SR, poka::output* out, th::thread_pool* pool) -> poka::result {
+	const auto result = [&]() {
+		if (should_abort()) { return poka::result::aborted; }
+		if (!remove_dc_bias(work, should_abort, progress_reporter, SR / 20)) { return poka::result::aborted; }
+		if (!pre_smooth(work, should_abort, progress_reporter, 3)) { return poka::result::aborted; }
+		switch (estimate_sizes<Mode>(work, should_abort, progress_reporter, depth, SR, out, pool)) {
+			case estimate_result::aborted: { return poka::result::aborted; }
+			case estimate_result::done:    { return poka::result::ok; }
+			default:                       { break; }
+		}
+		if (!post_smooth(*work, should_abort, progress_reporter, SR / 100, out)) { return poka::result::aborted; }
 		return poka::result::ok;
+	}();
+	if (result == poka::result::ok) {
+		flush_progress(progress_reporter);
 	}
-	if (!autocorrelation<Mode>(work, should_abort, progress_reporter, depth)) {
-		return poka::result::aborted;
+	return result;
+}
+
+// Reads all channels in one pass. Each call to get_frames
+// fills count * N floats in the given layout
+template <size_t N, size_t BufferSize, typename CB, typename ShouldAbortFn, typename ProgressReporter> [[nodiscard]] inline
+auto read_frames(std::array<poka::work, N>* work, CB cb, ShouldAbortFn should_abort, ProgressReporter* progress_reporter, poka::layout layout, size_t n) -> bool {
+	std::array<float, BufferSize * N> buffer;
+	for (auto& channel : *work) {
+		channel.frames.raw.clear();
 	}
-	write_estimated_sizes(work, progress_reporter);
-	if (should_abort()) { return poka::result::aborted; }
-	detail::post_smooth(*work, progress_reporter, SR / 100, out);
-	return poka::result::ok;
+	for (size_t beg = 0; beg < n; beg += BufferSize) {
+		if (should_abort()) {
+			return false;
+		}
+		const auto count = std::min(n - beg, BufferSize);
+		cb.get_frames(beg, count, buffer.data());
+		for (size_t c = 0; c < N; c++) {
+			auto& raw = (*work)[c].frames.raw;
+			raw.resize(beg + count);
+			if (layout == poka::layout::interleaved) {
+				for (size_t i = 0; i < count; i++) {
+					raw[beg + i] = buffer[(i * N) + c];
+				}
+			}
+			else {
+				std::copy(buffer.data() + (c * count), buffer.data() + ((c + 1) * count), raw.data() + beg);
+			}
+		}
+		complete_work(progress_reporter, (float(count) / n) * WORK_COST_READ_FRAMES);
+	}
+	return true;
 }
 
+// The same as remove_dc_bias() for every channel, in one pass
+// over the frames
+template <size_t N, typename ShouldAbortFn, typename ProgressReporter> [[nodiscard]]
+auto remove_dc_bias(std::array<poka::work, N>* work, ShouldAbortFn should_abort, ProgressReporter* progress_reporter, size_t window_size) -> bool {
+	namespace dc_bias = audio::dc_bias;
+	const auto size = (*work)[0].frames.raw.size();
+	std::array<dc_bias::frames, N> frames;
+	std::array<const std::vector<float>*, N> midpoints;
+	for (size_t c = 0; c < N; c++) {
+		auto& channel = (*work)[c];
+		channel.dc_window_midpoints.clear();
+		frames[c]    = {channel.frames.raw.data(), size};
+		midpoints[c] = &channel.dc_window_midpoints;
+	}
+	for (size_t beg = 0; beg < size; beg += window_size) {
+		if (should_abort()) {
+			return false;
+		}
+		const auto window = dc_bias::detail::detection_window{beg, std::min(size, beg + window_size)};
+		for (size_t c = 0; c < N; c++) {
+			(*work)[c].dc_window_midpoints.push_back(dc_bias::detail::detect_midpoint({frames[c].floats, size}, window_size, window));
+		}
+	}
+	complete_work(progress_reporter, WORK_COST_REMOVE_DC_BIAS * 0.5f);
+	for (size_t beg = 0; beg < size; beg += STAGE_CHUNK_SIZE) {
+		if (should_abort()) {
+			return false;
+		}
+		const auto end = std::min(size, beg + STAGE_CHUNK_SIZE);
+		dc_bias::apply_correction(frames, midpoints, window_size, beg, end);
+		complete_work(progress_reporter, (float(end - beg) / size) * WORK_COST_REMOVE_DC_BIAS * 0.5f);
+	}
+	return true;
+}
+
+// The same as smooth() for every channel, with the channels
+// as lanes of one sliding window pass
+template <size_t N, typename ShouldAbortFn, typename ProgressReporter> [[nodiscard]]
+auto smooth(const std::array<const std::vector<float>*, N>& in, ShouldAbortFn should_abort, ProgressReporter* progress_reporter, size_t window_size, float work_cost, const std::array<std::vector<float>*, N>& out) -> bool {
+	const auto size = in[0]->size();
+	std::array<const float*, N> in_frames;
+	std::array<float*, N> out_frames;
+	for (size_t c = 0; c < N; c++) {
+		in_frames[c] = in[c]->data();
+		out[c]->clear();
+		out[c]->reserve(size);
+	}
+	for (size_t beg = 0; beg < size; beg += STAGE_CHUNK_SIZE) {
+		if (should_abort()) {
+			return false;
+		}
+		const auto end = std::min(size, beg + STAGE_CHUNK_SIZE);
+		for (size_t c = 0; c < N; c++) {
+			out[c]->resize(end);
+			out_frames[c] = out[c]->data();
+		}
+		sliding_window::centered_mean(in_frames, size, window_size, beg, end, out_frames);
+		complete_work(progress_reporter, (float(end - beg) / size) * work_cost);
+	}
+	return true;
+}
+
+template <size_t N, typename ShouldAbortFn, typename ProgressReporter> [[nodiscard]]
+auto pre_smooth(std::array<poka::work, N>* work, ShouldAbortFn should_abort, ProgressReporter* progress_reporter, size_t window_size) -> bool {
+	if ((*work)[0].frames.raw.size() < window_size) {
+		for (auto& channel : *work) {
+			channel.frames.smoothed = channel.frames.raw;
+		}
+		return true;
+	}
+	std::array<const std::vector<float>*, N> in;
+	std::array<std::vector<float>*, N> out;
+	for (size_t c = 0; c < N; c++) {
+		in[c]  = &(*work)[c].frames.raw;
+		out[c] = &(*work)[c].frames.smoothed;
+	}
+	return smooth(in, should_abort, progress_reporter, window_size, WORK_COST_PRE_SMOOTH, out);
+}
+
+// Channels which estimate_sizes() finished off already are
+// left alone. If there are any, the others are smoothed one at
+// a time.
+template <size_t N, typename ShouldAbortFn, typename ProgressReporter> [[nodiscard]]
+auto post_smooth(const std::array<poka::work, N>& work, const std::array<estimate_result, N>& estimates, ShouldAbortFn should_abort, ProgressReporter* progress_reporter, size_t window_size, std::array<poka::output, N>* out) -> bool {
+	const auto needs_smoothing = [&estimates](size_t c) { return estimates[c] == estimate_result::needs_smoothing; };
+	if (work[0].frames.raw.size() < window_size) {
+		for (size_t c = 0; c < N; c++) {
+			if (needs_smoothing(c)) {
+				(*out)[c].frames.estimated_size = work[c].frames.estimated_size;
+			}
+		}
+		return true;
+	}
+	size_t count = 0;
+	for (size_t c = 0; c < N; c++) {
+		count += needs_smoothing(c) ? 1 : 0;
+	}
+	if (count < N) {
+		for (size_t c = 0; c < N; c++) {
+			if (!needs_smoothing(c)) {
+				continue;
+			}
+			if (!smooth(work[c].frames.estimated_size, should_abort, progress_reporter, window_size, float(WORK_COST_POST_SMOOTH) / N, &(*out)[c].frames.estimated_size)) {
+				return false;
+			}
+		}
+		return true;
+	}
+	std::array<const std::vector<float>*, N> in;
+	std::array<std::vector<float>*, N> sizes;
+	for (size_t c = 0; c < N; c++) {
+		in[c]    = &work[c].frames.estimated_size;
+		sizes[c] = &(*out)[c].frames.estimated_size;
+	}
+	return smooth(in, should_abort, progress_reporter, window_size, WORK_COST_POST_SMOOTH, sizes);
+}
+
+// While the calling thread waits for other threads to finish
+// their channels it checks for an abort and reports progress
+// this often
+static constexpr auto CALLER_POLL_INTERVAL = std::chrono::milliseconds(1);
+
 } // detail
 
+// If a thread pool is given then the cycle autocorrelation
+// stage is spread across its threads. The output is the
+// same either way. depth and pool are ignored in spectral
+// mode.
 template <mode Mode, typename CB> [[nodiscard]] inline
-auto autocorrelation(poka::work* work, CB cb, size_t n, size_t depth, size_t SR, poka::output* out) -> poka::result {
+auto autocorrelation(poka::work* work, CB cb, size_t n, size_t depth, size_t SR, poka::output* out, th::thread_pool* pool = nullptr) -> poka::result {
 	auto progress_reporter = detail::make_progress_reporter(cb.report_progress);
 	detail::add_work_to_do(&progress_reporter, float(detail::WORK_COST_TOTAL));
-	detail::read_frames<512>(work, cb, n);
-	detail::complete_work(&progress_reporter, detail::WORK_COST_READ_FRAMES);
-	if (cb.should_abort()) { return poka::result::aborted; }
-	detail::remove_dc_bias(work, SR / 20);
-	detail::complete_work(&progress_reporter, detail::WORK_COST_REMOVE_DC_BIAS);
-	if (cb.should_abort()) { return poka::result::aborted; }
-	detail::pre_smooth(work, &progress_reporter, 3);
-	if (cb.should_abort()) { return poka::result::aborted; }
-	detail::find_cycles(work, &progress_reporter);
-	if (cb.should_abort()) { return poka::result::aborted; }
-	return detail::autocorrelation<Mode>(work, cb.should_abort, &progress_reporter, depth, SR, out);
+	prepare(work, n, SR);
+	if (!detail::read_frames<512>(work, cb, &progress_reporter, n)) {
+		return poka::result::aborted;
+	}
+	return detail::analyse<Mode>(work, cb.should_abort, &progress_reporter, depth, SR, out, pool);
+}
+
+// Analyses N channels of the same sample. The frames are read
+// in a single pass: cb.get_frames(beg, count, buffer) must
+// write count * N floats to buffer, either interleaved or as N
+// consecutive blocks of count frames. out can be passed
+// straight to fudge as the per-channel analysis, and each
+// channel's output is the same as a mono analysis of it.
+//
+// The reading, DC removal and smoothing are done for all the
+// channels at once, with the channels as lanes of one pass
+// over the frames, so they cost little more than for one
+// channel. Finding and scoring the cycles (or the spectral
+// estimate) follows each channel's own signal and is done per
+// channel. If a thread pool is given, the channels are spread
+// across its threads for that part.
+//
+// should_abort and report_progress are only called from the
+// calling thread, which keeps calling them (every
+// CALLER_POLL_INTERVAL) while it waits for other threads.
+template <mode Mode, size_t N, typename CB> [[nodiscard]] inline
+auto autocorrelation(std::array<poka::work, N>* work, CB cb, poka::layout layout, size_t n, size_t depth, size_t SR, std::array<poka::output, N>* out, th::thread_pool* pool = nullptr) -> poka::result {
+	const auto caller_thread = std::this_thread::get_id();
+	// Each progress is a fraction of the whole job. The shared
+	// stages count once and the channel stages count 1 / N per
+	// channel.
+	float shared_progress = 0.0f;
+	float next_report     = 0.0f;
+	std::array<std::atomic<float>, N> channel_progress;
+	std::array<detail::estimate_result, N> estimates;
+	std::atomic<bool> aborted = false;
+	std::atomic<size_t> next_channel = 0;
+	for (auto& p : channel_progress) {
+		p = 0.0f;
+	}
+	estimates.fill(detail::estimate_result::aborted);
+	const auto on_caller_thread = [caller_thread]() { return std::this_thread::get_id() == caller_thread; };
+	const auto should_abort = [&]() {
+		if (on_caller_thread() && !aborted && cb.should_abort()) {
+			aborted = true;
+		}
+		return aborted.load(std::memory_order_relaxed);
+	};
+	// Only called from the calling thread
+	const auto report_total = [&]() {
+		float total = shared_progress;
+		for (const auto& p : channel_progress) {
+			total += p.load(std::memory_order_relaxed) / N;
+		}
+		if (total >= next_report) {
+			next_report = total + detail::PROGRESS_RESOLUTION;
+			cb.report_progress(total);
+		}
+	};
+	auto progress_reporter = detail::make_progress_reporter([&](float p) {
+		shared_progress = p;
+		report_total();
+	});
+	detail::add_work_to_do(&progress_reporter, float(detail::WORK_COST_TOTAL));
+	const auto estimate_channel = [&](size_t c) {
+		// A channel is estimated start to finish by one thread
+		const auto is_caller_thread = on_caller_thread();
+		auto channel_reporter = detail::make_progress_reporter([&, c, is_caller_thread](float p) {
+			channel_progress[c].store(p, std::memory_order_relaxed);
+			if (is_caller_thread) {
+				report_total();
+			}
+		});
+		detail::add_work_to_do(&channel_reporter, float(detail::WORK_COST_TOTAL));
+		estimates[c] = detail::estimate_sizes<Mode>(&(*work)[c], should_abort, &channel_reporter, depth, SR, &(*out)[c], nullptr);
+	};
+	// Channels are claimed one at a time by whichever thread
+	// is free
+	const auto estimate_channels = [&](size_t, size_t) {
+		for (auto c = next_channel++; c < N; c = next_channel++) {
+			estimate_channel(c);
+		}
+	};
+	const auto result = [&]() {
+		for (auto& channel : *work) {
+			prepare(&channel, n, SR);
+		}
+		if (!detail::read_frames<N, 512>(work, cb, should_abort, &progress_reporter, layout, n)) { return poka::result::aborted; }
+		if (!detail::remove_dc_bias(work, should_abort, &progress_reporter, SR / 20)) { return poka::result::aborted; }
+		if (!detail::pre_smooth(work, should_abort, &progress_reporter, 3)) { return poka::result::aborted; }
+		if (pool) {
+			const auto poll = [&]() {
+				(void)should_abort();
+				report_total();
+			};
+			pool->parallel_for(N, 1, estimate_channels, poll, detail::CALLER_POLL_INTERVAL);
+		}
+		else {
+			estimate_channels(0, N);
+		}
+		if (aborted || std::find(estimates.begin(), estimates.end(), detail::estimate_result::aborted) != estimates.end()) {
+			return poka::result::aborted;
+		}
+		if (!detail::post_smooth(*work, estimates, should_abort, &progress_reporter, SR / 100, out)) { return poka::result::aborted; }
+		return poka::result::ok;
+	}();
+	if (result == poka::result::ok) {
+		cb.report_progress(1.0f);
+	}
+	return result;
 }
 
 } // poka
@@ -0,0 +1,315 @@
+#pragma once
+
+#include "autocorrelation_compact.hpp"
+#include "autocorrelation_stream.hpp"
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <system_error>
+#include <vector>
+
+namespace snd {
+namespace poka {
+
+// On-disk cache of compact poka results, keyed by a hash of the
+// sample frames and the analysis parameters, so reloading a
+// sample doesn't mean analysing it again.
+//
+// Each result is one file in dir, named after its key. When the
+// files add up to more than max_bytes the least recently used
+// ones are deleted. Nothing here throws: if the cache can't be
+// read or written the analysis just runs as if it wasn't there.
+//
+// The format is native endian and is only meant to be read
+// back on the same machine.
+struct cache {
+	std::filesystem::path dir;
+	uintmax_t max_bytes = 0;
+};
+
+[[nodiscard]] inline
+auto make_cache(std::filesystem::path dir, uintmax_t max_bytes) -> poka::cache {
+	return {std::move(dir), max_bytes};
+}
+
+namespace detail {
+
+// Bump CACHE_ANALYSIS_VERSION whenever the analysis changes in a
+// way that changes its output, and CACHE_FORMAT_VERSION if the
+// file layout changes. Either way old files are just ignored
+// (and eventually evicted).
+static constexpr auto CACHE_ANALYSIS_VERSION = uint32_t(2);
+static constexpr auto CACHE_FORMAT_VERSION   = uint32_t(1);
+static constexpr char CACHE_MAGIC[4]         = {'P', 'O', 'K', 'A'};
+static constexpr auto CACHE_EXTENSION        = ".poka";
+static constexpr auto CACHE_HASH_CHUNK_SIZE  = size_t(16384);
+// The share of the progress given to hashing the frames. On a
+// miss the analysis reads them all again and does a lot more
+// besides, so this is only a rough guess.
+static constexpr auto CACHE_HASH_PROGRESS    = 0.1f;
+
+// Fast non-cryptographic 64-bit hash of a stream of 32-bit
+// words, along the lines of xxHash64: four independent lanes
+// (word i goes to lane i % 4) so the multiplies can overlap,
+// then a final avalanche. The result doesn't depend on how the
+// words are split into calls to hash_words.
+struct hash_state {
+	static constexpr uint64_t P1 = 0x9E3779B185EBCA87ULL;
+	static constexpr uint64_t P2 = 0xC2B2AE3D27D4EB4FULL;
+	static constexpr uint64_t P3 = 0x165667B19E3779F9ULL;
+	uint64_t lanes[4] = {P1 + P2, P2, 0, 0 - P1};
+	uint64_t count    = 0;
+};
+
+[[nodiscard]] inline
+auto rotl(uint64_t x, int r) -> uint64_t {
+	return (x << r) | (x >> (64 - r));
+}
+
+inline
+auto hash_words(hash_state* h, const uint32_t* words, size_t count) -> void {
+	for (size_t i = 0; i < count; i++) {
+		auto& lane = h->lanes[(h->count + i) & 3];
+		lane = rotl(lane + (uint64_t(words[i]) * hash_state::P2), 31) * hash_state::P1;
+	}
+	h->count += count;
+}
+
+inline
+auto hash_floats(hash_state* h, const float* values, size_t count) -> void {
+	static_assert(sizeof(float) == sizeof(uint32_t));
+	uint32_t words[256];
+	while (count > 0) {
+		const auto chunk = std::min(count, std::size(words));
+		std::memcpy(words, values, chunk * sizeof(float));
+		hash_words(h, words, chunk);
+		values += chunk;
+		count  -= chunk;
+	}
+}
+
+[[nodiscard]] inline
+auto hash_result(const hash_state& h) -> uint64_t {
+	auto out = rotl(h.lanes[0], 1) + rotl(h.lanes[1], 7) + rotl(h.lanes[2], 12) + rotl(h.lanes[3], 18);
+	out ^= h.count * hash_state::P3;
+	out ^= out >> 33;
+	out *= hash_state::P2;
+	out ^= out >> 29;
+	out *= hash_state::P3;
+	out ^= out >> 32;
+	return out;
+}
+
+// Returns false if cb.should_abort() says to stop. Progress is
+// reported up to CACHE_HASH_PROGRESS.
+template <mode Mode, typename CB> [[nodiscard]]
+auto cache_key(CB cb, size_t n, size_t depth, size_t SR, uint64_t* key) -> bool {
+	hash_state h;
+	const uint32_t params[] = {
+		CACHE_ANALYSIS_VERSION,
+		uint32_t(Mode),
+		uint32_t(depth),
+		uint32_t(SR),
+		uint32_t(uint64_t(n) >> 32),
+		uint32_t(n),
+	};
+	hash_words(&h, params, std::size(params));
+	std::vector<float> buffer(std::min(n, CACHE_HASH_CHUNK_SIZE));
+	for (size_t beg = 0; beg < n; beg += buffer.size()) {
+		if (cb.should_abort()) {
+			return false;
+		}
+		const auto count = std::min(n - beg, buffer.size());
+		cb.get_frames(beg, count, buffer.data());
+		hash_floats(&h, buffer.data(), count);
+		cb.report_progress(CACHE_HASH_PROGRESS * float(beg + count) / float(n));
+	}
+	*key = hash_result(h);
+	return true;
+}
+
+[[nodiscard]] inline
+auto cache_path(const poka::cache& c, uint64_t key) -> std::filesystem::path {
+	static constexpr char HEX[] = "0123456789abcdef";
+	std::string name(16, '0');
+	for (size_t i = 0; i < 16; i++) {
+		name[15 - i] = HEX[(key >> (i * 4)) & 0xF];
+	}
+	return c.dir / (name + CACHE_EXTENSION);
+}
+
+struct cache_header {
+	char magic[4];
+	uint32_t version;
+	uint64_t key;
+	uint64_t frame_count;
+	uint64_t breakpoint_count;
+	uint64_t checksum;
+};
+
+[[nodiscard]] inline
+auto checksum(const poka::compact_output& result) -> uint64_t {
+	hash_state h;
+	hash_words(&h, result.frames.data(), result.frames.size());
+	hash_floats(&h, result.sizes.data(), result.sizes.size());
+	return hash_result(h);
+}
+
+template <typename T>
+auto write_pod(std::ofstream* file, const T* data, size_t count) -> void {
+	file->write(reinterpret_cast<const char*>(data), std::streamsize(count * sizeof(T)));
+}
+
+template <typename T>
+auto read_pod(std::ifstream* file, T* data, size_t count) -> void {
+	file->read(reinterpret_cast<char*>(data), std::streamsize(count * sizeof(T)));
+}
+
+[[nodiscard]] inline
+auto cache_load(const poka::cache& c, uint64_t key, poka::compact_output* out) -> bool {
+	std::error_code ec;
+	const auto path = cache_path(c, key);
+	const auto file_size = std::filesystem::file_size(path, ec);
+	if (ec) {
+		return false;
+	}
+	std::ifstream file{path, std::ios::binary};
+	cache_header header;
+	read_pod(&file, &header, 1);
+	const auto valid =
+		file &&
+		std::memcmp(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC)) == 0 &&
+		header.version == CACHE_FORMAT_VERSION &&
+		header.key == key &&
+		file_size == sizeof(cache_header) + (header.breakpoint_count * (sizeof(uint32_t) + sizeof(float)));
+	if (!valid) {
+		return false;
+	}
+	out->frame_count = size_t(header.frame_count);
+	out->frames.resize(size_t(header.breakpoint_count));
+	out->sizes.resize(size_t(header.breakpoint_count));
+	read_pod(&file, out->frames.data(), out->frames.size());
+	read_pod(&file, out->sizes.data(), out->sizes.size());
+	if (!file || checksum(*out) != header.checksum) {
+		return false;
+	}
+	build_index(out);
+	// Counts as a use for eviction
+	std::filesystem::last_write_time(path, std::filesystem::file_time_type::clock::now(), ec);
+	return true;
+}
+
+// Written to a temporary file first so that a reader never
+// sees a partial result
+inline
+auto cache_store(const poka::cache& c, uint64_t key, const poka::compact_output& result) -> void {
+	std::error_code ec;
+	std::filesystem::create_directories(c.dir, ec);
+	const auto path = cache_path(c, key);
+	auto tmp_path = path;
+	tmp_path += ".tmp";
+	{
+		std::ofstream file{tmp_path, std::ios::binary | std::ios::trunc};
+		cache_header header;
+		std::memcpy(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC));
+		header.version          = CACHE_FORMAT_VERSION;
+		header.key              = key;
+		header.frame_count      = result.frame_count;
+		header.breakpoint_count = result.frames.size();
+		header.checksum         = checksum(result);
+		write_pod(&file, &header, 1);
+		write_pod(&file, result.frames.data(), result.frames.size());
+		write_pod(&file, result.sizes.data(), result.sizes.size());
+		if (!file) {
+			file.close();
+			std::filesystem::remove(tmp_path, ec);
+			return;
+		}
+	}
+	std::filesystem::rename(tmp_path, path, ec);
+	if (ec) {
+		std::filesystem::remove(tmp_path, ec);
+	}
+}
+
+struct cache_entry {
+	std::filesystem::path path;
+	std::filesystem::file_time_type time;
+	uintmax_t size;
+};
+
+} // detail
+
+// Deletes least recently used results until the cache fits in
+// max_bytes
+inline
+auto evict(const poka::cache& c) -> void {
+	namespace fs = std::filesystem;
+	std::error_code ec;
+	std::vector<detail::cache_entry> entries;
+	uintmax_t total = 0;
+	for (fs::directory_iterator it{c.dir, ec}, end; !ec && it != end; it.increment(ec)) {
+		if (it->path().extension() != detail::CACHE_EXTENSION) {
+			continue;
+		}
+		std::error_code entry_ec;
+		detail::cache_entry entry;
+		entry.path = it->path();
+		entry.size = it->file_size(entry_ec);
+		entry.time = it->last_write_time(entry_ec);
+		if (entry_ec) {
+			continue;
+		}
+		total += entry.size;
+		entries.push_back(std::move(entry));
+	}
+	if (total <= c.max_bytes) {
+		return;
+	}
+	std::sort(entries.begin(), entries.end(), [](const auto& a, const auto& b) { return a.time < b.time; });
+	for (const auto& entry : entries) {
+		if (total <= c.max_bytes) {
+			return;
+		}
+		if (fs::remove(entry.path, ec)) {
+			total -= entry.size;
+		}
+	}
+}
+
+// Like stream_autocorrelation but returns the compact result,
+// loading it from the cache if the same frames have been
+// analysed with the same parameters before. The frames are read
+// once to compute the key, and once more on a miss. Both passes
+// check cb.should_abort() and report progress.
+template <mode Mode, typename CB> [[nodiscard]]
+auto cached_autocorrelation(const poka::cache& c, CB cb, size_t n, size_t depth, size_t SR, poka::compact_output* out) -> poka::result {
+	uint64_t key;
+	if (!detail::cache_key<Mode>(cb, n, depth, SR, &key)) {
+		return poka::result::aborted;
+	}
+	if (detail::cache_load(c, key, out)) {
+		cb.report_progress(1.0f);
+		return poka::result::ok;
+	}
+	if (cb.should_abort()) { return poka::result::aborted; }
+	auto builder = make_compact_builder();
+	const auto emit = [&builder](size_t beg, const float* sizes, size_t count) { add(&builder, beg, sizes, count); };
+	const auto report_progress = [&cb](float progress) {
+		cb.report_progress(detail::CACHE_HASH_PROGRESS + ((1.0f - detail::CACHE_HASH_PROGRESS) * progress));
+	};
+	const auto analysis_cb = make_cbs(cb.get_frames, report_progress, cb.should_abort);
+	if (stream_autocorrelation<Mode>(analysis_cb, n, depth, SR, emit) == poka::result::aborted) {
+		return poka::result::aborted;
+	}
+	*out = finish(&builder);
+	detail::cache_store(c, key, *out);
+	evict(c);
+	return poka::result::ok;
+}
+
+} // poka
+} // snd
\ No newline at end of file
@@ -0,0 +1,198 @@
+#pragma once
+
+#include "autocorrelation.hpp"
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <limits>
+
+namespace snd {
+namespace poka {
+
+// Compact form of poka::output. The estimated sizes are
+// piecewise linear (per cycle, then blurred by the post
+// smoothing) so they are stored as breakpoints of a continuous
+// piecewise linear curve which stays within a tolerance of the
+// dense values at every frame. Each breakpoint is a frame
+// number and a size, 8 bytes, against 4 bytes per frame for
+// poka::output.
+//
+// The number of breakpoints depends on how much the estimates
+// move about. A clean tone needs a breakpoint every few cycles.
+// Noise makes the cycle by cycle estimates of classic and
+// milestones jitter, which needs more, and the tolerance sets
+// how much of that jitter is kept.
+//
+// index[b] is the last breakpoint at or before frame
+// b << COMPACT_INDEX_SHIFT, so a lookup only has to search
+// the breakpoints of one block.
+struct compact_output {
+	std::vector<uint32_t> frames;
+	std::vector<float> sizes;
+	std::vector<uint32_t> index;
+	size_t frame_count = 0;
+};
+
+// Builds a compact_output from consecutive runs of estimated
+// sizes, e.g. the emit callback of a poka::stream, so the
+// dense sizes never have to exist all at once.
+//
+// This is the usual "feasible slope" fit: each segment starts
+// at the end of the previous one and is extended for as long
+// as some slope keeps it within tolerance of every frame
+// it covers.
+struct compact_builder {
+	double tolerance   = 0.0;
+	double anchor_x    = 0.0;
+	double anchor_y    = 0.0;
+	double slope_lo    = 0.0;
+	double slope_hi    = 0.0;
+	size_t frame_count = 0;
+	poka::compact_output out;
+};
+
+// The default tolerance, in frames. Estimated sizes are
+// usually hundreds of frames, so this is well under a percent.
+static constexpr auto COMPACT_TOLERANCE   = 0.25f;
+static constexpr auto COMPACT_INDEX_SHIFT = 12;
+
+namespace detail {
+
+// The fit is made this much (relative to the size) tighter than
+// the tolerance, to leave room for rounding the breakpoints and
+// the looked up sizes to float
+static constexpr auto COMPACT_ROUNDING_MARGIN = 1.0 / double(1 << 21);
+
+[[nodiscard]] inline
+auto fit_tolerance(const poka::compact_builder& b, float size) -> double {
+	return std::max(0.0, b.tolerance - (std::abs(double(size)) * COMPACT_ROUNDING_MARGIN));
+}
+
+inline
+auto reset_slopes(poka::compact_builder* b) -> void {
+	b->slope_lo = std::numeric_limits<double>::lowest();
+	b->slope_hi = std::numeric_limits<double>::max();
+}
+
+inline
+auto add_breakpoint(poka::compact_builder* b, size_t frame, double size) -> void {
+	assert(frame <= std::numeric_limits<uint32_t>::max());
+	b->out.frames.push_back(uint32_t(frame));
+	b->out.sizes.push_back(float(size));
+	b->anchor_x = double(frame);
+	b->anchor_y = double(float(size));
+	reset_slopes(b);
+}
+
+// Ends the current segment at frame
+inline
+auto close_segment(poka::compact_builder* b, size_t frame) -> void {
+	const auto slope = (b->slope_lo + b->slope_hi) * 0.5;
+	add_breakpoint(b, frame, b->anchor_y + (slope * (double(frame) - b->anchor_x)));
+}
+
+inline
+auto add_frame(poka::compact_builder* b, float size) -> void {
+	const auto frame = b->frame_count++;
+	if (frame == 0) {
+		add_breakpoint(b, 0, size);
+		return;
+	}
+	const auto tolerance = fit_tolerance(*b, size);
+	for (;;) {
+		const auto dx = double(frame) - b->anchor_x;
+		const auto lo = std::max(b->slope_lo, (double(size) - tolerance - b->anchor_y) / dx);
+		const auto hi = std::min(b->slope_hi, (double(size) + tolerance - b->anchor_y) / dx);
+		if (lo <= hi) {
+			b->slope_lo = lo;
+			b->slope_hi = hi;
+			return;
+		}
+		// The previous frame is always within tolerance of the
+		// new anchor so this only loops once
+		close_segment(b, frame - 1);
+	}
+}
+
+inline
+auto build_index(poka::compact_output* c) -> void {
+	const auto block_count = (c->frame_count >> COMPACT_INDEX_SHIFT) + 1;
+	c->index.resize(block_count);
+	size_t bp = 0;
+	for (size_t block = 0; block < block_count; block++) {
+		const auto frame = block << COMPACT_INDEX_SHIFT;
+		while (bp + 1 < c->frames.size() && c->frames[bp + 1] <= frame) {
+			bp++;
+		}
+		c->index[block] = uint32_t(bp);
+	}
+}
+
+} // detail
+
+[[nodiscard]] inline
+auto make_compact_builder(float tolerance = COMPACT_TOLERANCE) -> compact_builder {
+	compact_builder out;
+	out.tolerance = tolerance;
+	detail::reset_slopes(&out);
+	return out;
+}
+
+// Runs must be consecutive, starting at frame 0. beg is only
+// used to check that.
+inline
+auto add(poka::compact_builder* b, size_t beg, const float* sizes, size_t count) -> void {
+	assert(beg == b->frame_count);
+	for (size_t i = 0; i < count; i++) {
+		detail::add_frame(b, sizes[i]);
+	}
+}
+
+[[nodiscard]] inline
+auto finish(poka::compact_builder* b) -> compact_output {
+	if (b->frame_count > 1 && b->out.frames.back() != b->frame_count - 1) {
+		detail::close_segment(b, b->frame_count - 1);
+	}
+	b->out.frame_count = b->frame_count;
+	detail::build_index(&b->out);
+	return std::move(b->out);
+}
+
+[[nodiscard]] inline
+auto compact(const poka::output& output, float tolerance = COMPACT_TOLERANCE) -> compact_output {
+	auto builder = make_compact_builder(tolerance);
+	const auto& sizes = output.frames.estimated_size;
+	add(&builder, 0, sizes.data(), sizes.size());
+	return finish(&builder);
+}
+
+// Frames past the end get the last estimated size, like
+// fudge has always done with the dense output
+[[nodiscard]] inline
+auto estimated_size(const poka::output& output, size_t frame) -> float {
+	const auto& sizes = output.frames.estimated_size;
+	return frame >= sizes.size() ? sizes.back() : sizes[frame];
+}
+
+[[nodiscard]] inline
+auto estimated_size(const poka::compact_output& c, size_t frame) -> float {
+	if (c.frames.empty()) {
+		return detail::DEFAULT_SIZE;
+	}
+	if (frame >= c.frames.back()) {
+		return c.sizes.back();
+	}
+	const auto block = frame >> COMPACT_INDEX_SHIFT;
+	const auto beg   = c.frames.begin() + c.index[block];
+	const auto end   = block + 1 < c.index.size() ? c.frames.begin() + std::min(c.frames.size(), size_t(c.index[block + 1]) + 2) : c.frames.end();
+	const auto next  = size_t(std::upper_bound(beg, end, uint32_t(frame)) - c.frames.begin());
+	const auto prev  = next - 1;
+	// In double precision so that the only rounding is the final
+	// one, which fit_tolerance() leaves room for
+	const auto t     = double(frame - c.frames[prev]) / double(c.frames[next] - c.frames[prev]);
+	const auto size  = double(c.sizes[prev]) + ((double(c.sizes[next]) - double(c.sizes[prev])) * t);
+	return float(size);
+}
+
+} // poka
+} // snd
\ No newline at end of file
@@ -0,0 +1,492 @@
+#pragma once
+
+#include "autocorrelation.hpp"
+
+namespace snd {
+namespace poka {
+
+// Streaming version of poka::autocorrelation. Frames are pushed
+// in chunks of any size and the final (post smoothed) estimated
+// sizes are emitted as soon as nothing later in the signal can
+// change them, so a long file never has to be held in memory.
+//
+// Only a look-behind window is kept: the frames of the cycles
+// which haven't been scored yet (about 2*depth cycles in
+// milestones mode, or depth cycles and the same length again
+// in classic mode), one analysis window in spectral mode, and
+// the smoothing radii.
+//
+// Every stage runs the same code as the whole-file analysis
+// so the emitted sizes match it, apart from double precision
+// rounding in the smoothing sums.
+
+template <mode Mode>
+struct stream {
+	size_t SR    = 0;
+	size_t depth = 0;
+	// Frames pushed so far
+	size_t frame_count = 0;
+	// work holds raw and smoothed frames from frame_offset and
+	// cycles from cycle_offset. Frame positions stored in the
+	// cycles are relative to frame_offset.
+	poka::work work;
+	size_t frame_offset = 0;
+	size_t cycle_offset = 0;
+	struct {
+		size_t window_size   = 0;
+		size_t window_count  = 0;
+		size_t corrected_end = 0;
+		float midpoint       = 0.0f;
+	} dc;
+	sliding_window::centered_mean_stream pre_smooth;
+	detail::find_cycles_state find_cycles;
+	size_t frames_searched = 0;
+	size_t cycles_scored   = 0;
+	size_t cycles_written  = 0;
+	struct {
+		// Periods from period_offset. Silent hops are resolved
+		// as soon as they are estimated, except at the start
+		// where they wait for the first non-silent hop.
+		std::vector<float> periods;
+		size_t period_offset  = 0;
+		size_t hop_count      = 0;
+		size_t hops_written   = 0;
+		bool head_written     = false;
+		bool known            = false;
+	} spectral;
+	// Estimated sizes from sizes_offset, before post smoothing
+	std::vector<float> sizes;
+	size_t sizes_offset = 0;
+	sliding_window::centered_mean_stream post_smooth;
+	std::vector<float> out;
+};
+
+namespace detail {
+
+static constexpr auto STREAM_PRE_SMOOTH_RADIUS = size_t(3);
+static constexpr auto STREAM_READ_CHUNK_SIZE   = size_t(16384);
+static constexpr auto STREAM_EMIT_CHUNK_SIZE   = size_t(4096);
+// Discarded frames and cycles are only erased once there are
+// this many of them (and they make up at least half of what
+// is held) so erasing is amortized O(1) per frame.
+static constexpr auto STREAM_REBASE_MIN_FRAMES = size_t(1) << 16;
+static constexpr auto STREAM_REBASE_MIN_CYCLES = size_t(1024);
+
+template <mode Mode> [[nodiscard]] inline
+auto sizes_end(const poka::stream<Mode>& s) -> size_t {
+	return s.sizes_offset + s.sizes.size();
+}
+
+template <mode Mode> [[nodiscard]] inline
+auto cycles_found(const poka::stream<Mode>& s) -> size_t {
+	return s.cycle_offset + s.work.cycle_info.size();
+}
+
+template <mode Mode> [[nodiscard]] inline
+auto smoothed_end(const poka::stream<Mode>& s) -> size_t {
+	return s.pre_smooth.index;
+}
+
+template <mode Mode> [[nodiscard]] inline
+auto local_cycle(const poka::stream<Mode>& s, size_t cycle_idx) -> size_t {
+	return cycle_idx - s.cycle_offset;
+}
+
+template <mode Mode> inline
+auto write_sizes(poka::stream<Mode>* s, size_t end, float size) -> void {
+	if (end > sizes_end(*s)) {
+		s->sizes.resize(end - s->sizes_offset, size);
+	}
+}
+
+template <mode Mode> inline
+auto correct_dc(poka::stream<Mode>* s, size_t end, float value) -> void {
+	for (auto i = s->dc.corrected_end; i < end; i++) {
+		s->work.frames.raw[i - s->frame_offset] -= value;
+	}
+	s->dc.corrected_end = std::max(s->dc.corrected_end, end);
+}
+
+// Same corrections as dc_bias::detail::generate_frame_values,
+// applied one window at a time
+template <mode Mode> inline
+auto add_dc_window(poka::stream<Mode>* s, size_t window_end, size_t frame_count) -> void {
+	namespace dc = audio::dc_bias;
+	const auto window_size = s->dc.window_size;
+	const auto window_beg  = s->dc.window_count * window_size;
+	const auto frames      = dc::const_frames{s->work.frames.raw.data() + (window_beg - s->frame_offset), window_end - window_beg};
+	const auto midpoint    = dc::detail::detect_midpoint(frames, window_size, {0, frames.size});
+	const auto center      = dc::detail::get_window_center(window_size, 0, frame_count, s->dc.window_count);
+	if (s->dc.window_count == 0) {
+		correct_dc(s, center, midpoint);
+	}
+	else {
+		const auto prev_midpoint = s->dc.midpoint;
+		const auto beg = s->dc.corrected_end;
+		for (auto i = beg; i < center; i++) {
+			const auto t = static_cast<float>(i - beg) / static_cast<float>(window_size);
+			s->work.frames.raw[i - s->frame_offset] -= dc::detail::frame_value(prev_midpoint, midpoint, t);
+		}
+		s->dc.corrected_end = center;
+	}
+	s->dc.midpoint = midpoint;
+	s->dc.window_count++;
+}
+
+template <mode Mode> inline
+auto stream_remove_dc_bias(poka::stream<Mode>* s, bool final) -> void {
+	const auto window_size = s->dc.window_size;
+	// The center of a complete window is always before the end
+	// of the signal so it doesn't depend on the final size
+	while (((s->dc.window_count + 1) * window_size) <= s->frame_count) {
+		add_dc_window(s, (s->dc.window_count + 1) * window_size, std::numeric_limits<size_t>::max());
+	}
+	if (!final) {
+		return;
+	}
+	if ((s->dc.window_count * window_size) < s->frame_count) {
+		add_dc_window(s, s->frame_count, s->frame_count);
+	}
+	if (s->dc.window_count > 0) {
+		correct_dc(s, s->frame_count, s->dc.midpoint);
+	}
+}
+
+template <mode Mode> inline
+auto stream_pre_smooth(poka::stream<Mode>* s, bool final) -> void {
+	auto& smoothed = s->work.frames.smoothed;
+	const auto& raw = s->work.frames.raw;
+	const auto value_at = [s, &raw](size_t i) { return raw[i - s->frame_offset]; };
+	if (final && s->frame_count < s->pre_smooth.radius) {
+		smoothed = raw;
+		s->pre_smooth.index = s->frame_count;
+		return;
+	}
+	const auto size = final ? s->frame_count : s->dc.corrected_end;
+	while (s->pre_smooth.index < s->frame_count) {
+		if (!final && s->pre_smooth.index + s->pre_smooth.radius > size) {
+			return;
+		}
+		smoothed.push_back(sliding_window::next(&s->pre_smooth, size, value_at));
+	}
+}
+
+template <mode Mode> inline
+auto stream_find_cycles(poka::stream<Mode>* s) -> void {
+	for (; s->frames_searched < smoothed_end(*s); s->frames_searched++) {
+		find_cycles_step(&s->work, &s->find_cycles, s->frames_searched - s->frame_offset);
+	}
+}
+
+// Whether cycle_idx would be scored the same now as with the
+// whole signal, i.e. everything the scoring loop could look at
+// before running out of depth has been found already
+template <mode Mode> [[nodiscard]] inline
+auto can_score_cycle(const poka::stream<Mode>& s, size_t cycle_idx) -> bool {
+	if (s.depth <= 1) {
+		return true;
+	}
+	if constexpr (Mode == mode::milestones) {
+		return cycles_found(s) >= cycle_idx + (s.depth * 2) - 1;
+	}
+	else {
+		if (cycles_found(s) < cycle_idx + s.depth) {
+			return false;
+		}
+		const auto beg_a = s.work.cycle_range[local_cycle(s, cycle_idx)].beg;
+		const auto beg_b = s.work.cycle_range[local_cycle(s, cycle_idx + s.depth - 1)].beg;
+		return smoothed_end(s) - s.frame_offset >= (beg_b * 2) - beg_a;
+	}
+}
+
+template <mode Mode> inline
+auto stream_score_cycles(poka::stream<Mode>* s, bool final) -> void {
+	for (; s->cycles_scored < cycles_found(*s); s->cycles_scored++) {
+		if (!final && !can_score_cycle(*s, s->cycles_scored)) {
+			break;
+		}
+		cycle_autocorrelation<Mode>(&s->work, local_cycle(*s, s->cycles_scored), s->depth);
+	}
+}
+
+// Same sizes as write_estimated_sizes. Nothing can be written
+// until there are at least two cycles because the zero and one
+// cycle cases are handled differently.
+template <mode Mode> inline
+auto stream_write_cycle_sizes(poka::stream<Mode>* s, bool final) -> void {
+	const auto cycle_count = cycles_found(*s);
+	if (cycle_count < 2) {
+		return;
+	}
+	const auto& work = s->work;
+	if (s->cycles_written == 0 && s->cycles_scored > 0) {
+		write_sizes(s, work.cycle_range[local_cycle(*s, 0)].end + s->frame_offset, cycle_size(work, local_cycle(*s, 0)));
+		s->cycles_written = 1;
+	}
+	for (; s->cycles_written < s->cycles_scored && s->cycles_written + 1 < cycle_count; s->cycles_written++) {
+		const auto idx_b   = local_cycle(*s, s->cycles_written);
+		const auto range_b = work.cycle_range[idx_b];
+		const auto len_b   = float(range_b.end - range_b.beg);
+		const auto size_a  = cycle_size(work, idx_b - 1);
+		const auto size_b  = cycle_size(work, idx_b);
+		for (auto j = range_b.beg; j < range_b.end; j++) {
+			s->sizes.push_back(lerp(size_a, size_b, float(j - range_b.beg) / len_b));
+		}
+	}
+	if (final) {
+		const auto idx = local_cycle(*s, cycle_count - 1);
+		write_sizes(s, s->frame_count, cycle_size(work, idx));
+		s->cycles_written = cycle_count;
+	}
+}
+
+template <mode Mode> [[nodiscard]] inline
+auto spectral_center(const poka::stream<Mode>& s, size_t hop) -> size_t {
+	return (hop * s.work.spectral.hop) + (s.work.spectral.window / 2);
+}
+
+template <mode Mode> inline
+auto add_spectral_period(poka::stream<Mode>* s, float period) -> void {
+	auto& sp = s->spectral;
+	if (period > 0.0f && !sp.known) {
+		std::fill(sp.periods.begin(), sp.periods.end(), period);
+		sp.known = true;
+	}
+	if (period <= 0.0f && sp.known) {
+		period = sp.periods.back();
+	}
+	sp.periods.push_back(period);
+	sp.hop_count++;
+}
+
+// Same sizes as spectral_estimate, written as soon as the
+// periods on either side are known
+template <mode Mode> inline
+auto stream_spectral(poka::stream<Mode>* s, bool final) -> void {
+	auto& sp = s->spectral;
+	const auto hop     = s->work.spectral.hop;
+	const auto length  = s->work.spectral.window + s->work.spectral.max_lag + 1;
+	const auto period  = [&sp](size_t idx) { return sp.periods[idx - sp.period_offset]; };
+	for (;;) {
+		const auto beg = sp.hop_count * hop;
+		if (final ? beg >= s->frame_count : beg + length > smoothed_end(*s)) {
+			break;
+		}
+		add_spectral_period(s, spectral_period(s->work.frames.smoothed, beg - s->frame_offset, &s->work.spectral));
+	}
+	if (final && !sp.known) {
+		write_sizes(s, s->frame_count, DEFAULT_SIZE);
+		return;
+	}
+	if (!sp.known) {
+		return;
+	}
+	if (!sp.head_written) {
+		write_sizes(s, std::min(s->frame_count, spectral_center(*s, 0)), period(0));
+		sp.head_written = true;
+	}
+	for (; sp.hops_written + 1 < sp.hop_count; sp.hops_written++) {
+		const auto beg = spectral_center(*s, sp.hops_written);
+		const auto end = std::min(s->frame_count, spectral_center(*s, sp.hops_written + 1));
+		const auto a   = period(sp.hops_written);
+		const auto b   = period(sp.hops_written + 1);
+		for (auto i = beg; i < end; i++) {
+			s->sizes.push_back(lerp(a, b, float(i - beg) / float(hop)));
+		}
+	}
+	if (final) {
+		write_sizes(s, s->frame_count, period(sp.hop_count - 1));
+	}
+}
+
+template <mode Mode, typename EmitFn> inline
+auto stream_post_smooth(poka::stream<Mode>* s, bool final, EmitFn&& emit) -> void {
+	const auto beg = s->post_smooth.index;
+	const auto value_at = [s](size_t i) { return s->sizes[i - s->sizes_offset]; };
+	s->out.clear();
+	if (final && s->frame_count < s->post_smooth.radius) {
+		for (auto i = beg; i < s->frame_count; i++) {
+			s->out.push_back(value_at(i));
+		}
+		s->post_smooth.index = s->frame_count;
+	}
+	else {
+		const auto size = final ? s->frame_count : sizes_end(*s);
+		while (s->post_smooth.index < size) {
+			if (!final && s->post_smooth.index + s->post_smooth.radius > size) {
+				break;
+			}
+			s->out.push_back(sliding_window::next(&s->post_smooth, size, value_at));
+		}
+	}
+	if (!s->out.empty()) {
+		emit(beg, s->out.data(), s->out.size());
+	}
+}
+
+template <typename EmitFn> inline
+auto stream_emit_constant(size_t beg, size_t end, float size, EmitFn&& emit) -> void {
+	std::vector<float> buffer(std::min(end - beg, STREAM_EMIT_CHUNK_SIZE), size);
+	for (; beg < end; beg += buffer.size()) {
+		emit(beg, buffer.data(), std::min(end - beg, buffer.size()));
+	}
+}
+
+template <typename T> inline
+auto erase_front(std::vector<T>* v, size_t count) -> void {
+	v->erase(v->begin(), v->begin() + count);
+}
+
+[[nodiscard]] inline
+auto should_rebase(size_t dead, size_t held, size_t min) -> bool {
+	return dead >= min && dead * 2 >= held;
+}
+
+// Drops whatever no stage will look at again
+template <mode Mode> inline
+auto stream_rebase(poka::stream<Mode>* s) -> void {
+	auto& work = s->work;
+	// Cycles
+	if constexpr (Mode != mode::spectral) {
+		const auto keep = std::min(s->cycles_scored, s->cycles_written > 0 ? s->cycles_written - 1 : 0);
+		const auto dead = keep - s->cycle_offset;
+		if (should_rebase(dead, work.cycle_info.size(), STREAM_REBASE_MIN_CYCLES)) {
+			erase_front(&work.cycle_info, dead);
+			erase_front(&work.cycle_range, dead);
+			erase_front(&work.cycle_best_match, dead);
+			s->find_cycles.cycle_idx -= dead;
+			s->cycle_offset += dead;
+		}
+	}
+	// Frames
+	{
+		auto keep = s->pre_smooth.window_beg;
+		if (s->find_cycles.init) {
+			keep = std::min(keep, s->find_cycles.cycle_beg + s->frame_offset);
+		}
+		if (s->cycles_scored < cycles_found(*s)) {
+			keep = std::min(keep, work.cycle_range[local_cycle(*s, s->cycles_scored)].beg + s->frame_offset);
+		}
+		// With depth <= 1 the newest cycle is scored as soon as it
+		// is found, but its sizes aren't written until the next
+		// one is
+		if (s->cycles_written < cycles_found(*s)) {
+			keep = std::min(keep, work.cycle_range[local_cycle(*s, s->cycles_written)].beg + s->frame_offset);
+		}
+		if constexpr (Mode == mode::spectral) {
+			keep = std::min(keep, s->spectral.hop_count * s->work.spectral.hop);
+		}
+		const auto dead = keep - s->frame_offset;
+		if (should_rebase(dead, work.frames.raw.size(), STREAM_REBASE_MIN_FRAMES)) {
+			erase_front(&work.frames.raw, dead);
+			erase_front(&work.frames.smoothed, dead);
+			for (size_t i = 0; i < work.cycle_info.size(); i++) {
+				work.cycle_info[i].zenith.pos -= dead;
+				work.cycle_info[i].nadir.pos  -= dead;
+				work.cycle_info[i].dive_pos   -= dead;
+				work.cycle_range[i].beg       -= dead;
+				work.cycle_range[i].end       -= dead;
+				work.cycle_best_match[i]      -= dead;
+			}
+			// These may wrap before the first cycle is found but
+			// they are only ever used in differences so that's ok
+			s->find_cycles.cycle_beg -= dead;
+			s->find_cycles.dive_pos  -= dead;
+			s->frame_offset += dead;
+		}
+	}
+	// Sizes
+	{
+		const auto dead = s->post_smooth.window_beg - s->sizes_offset;
+		if (should_rebase(dead, s->sizes.size(), STREAM_REBASE_MIN_FRAMES)) {
+			erase_front(&s->sizes, dead);
+			s->sizes_offset += dead;
+		}
+	}
+	// Periods
+	if constexpr (Mode == mode::spectral) {
+		auto& sp = s->spectral;
+		const auto dead = sp.known ? sp.hops_written - sp.period_offset : 0;
+		if (should_rebase(dead, sp.periods.size(), STREAM_REBASE_MIN_CYCLES)) {
+			erase_front(&sp.periods, dead);
+			sp.period_offset += dead;
+		}
+	}
+}
+
+template <mode Mode, typename EmitFn> inline
+auto stream_process(poka::stream<Mode>* s, bool final, EmitFn&& emit) -> void {
+	stream_remove_dc_bias(s, final);
+	stream_pre_smooth(s, final);
+	if constexpr (Mode == mode::spectral) {
+		stream_spectral(s, final);
+	}
+	else {
+		stream_find_cycles(s);
+		stream_score_cycles(s, final);
+		stream_write_cycle_sizes(s, final);
+		if (final && cycles_found(*s) < 2) {
+			const auto& range = s->work.cycle_range;
+			const auto size   = range.empty() ? DEFAULT_SIZE : float(range[0].end - range[0].beg);
+			stream_emit_constant(0, s->frame_count, size, emit);
+			return;
+		}
+	}
+	stream_post_smooth(s, final, emit);
+	stream_rebase(s);
+}
+
+} // detail
+
+template <mode Mode> [[nodiscard]] inline
+auto make_stream(size_t depth, size_t SR) -> poka::stream<Mode> {
+	poka::stream<Mode> out;
+	out.SR                 = SR;
+	out.depth              = depth;
+	out.dc.window_size     = SR / 20;
+	out.pre_smooth.radius  = detail::STREAM_PRE_SMOOTH_RADIUS;
+	out.post_smooth.radius = SR / 100;
+	if constexpr (Mode == mode::spectral) {
+		out.work.spectral = detail::make_spectral_scratch(SR);
+	}
+	return out;
+}
+
+// emit(frame_beg, estimated_sizes, count) is called with each
+// new run of estimated sizes. Runs are consecutive, starting
+// at frame 0.
+template <mode Mode, typename EmitFn> inline
+auto push(poka::stream<Mode>* s, const float* frames, size_t count, EmitFn&& emit) -> void {
+	s->work.frames.raw.insert(s->work.frames.raw.end(), frames, frames + count);
+	s->frame_count += count;
+	detail::stream_process(s, false, emit);
+}
+
+// Call once after the last frame has been pushed to emit the
+// remaining estimated sizes
+template <mode Mode, typename EmitFn> inline
+auto finish(poka::stream<Mode>* s, EmitFn&& emit) -> void {
+	detail::stream_process(s, true, emit);
+}
+
+// Reads the frames in chunks with cb.get_frames and streams
+// them through the analysis. report_progress is called once
+// per chunk.
+template <mode Mode, typename CB, typename EmitFn> [[nodiscard]] inline
+auto stream_autocorrelation(CB cb, size_t n, size_t depth, size_t SR, EmitFn&& emit) -> poka::result {
+	auto s = make_stream<Mode>(depth, SR);
+	std::vector<float> buffer(std::min(n, detail::STREAM_READ_CHUNK_SIZE));
+	for (size_t beg = 0; beg < n; beg += buffer.size()) {
+		if (cb.should_abort()) { return poka::result::aborted; }
+		const auto count = std::min(n - beg, buffer.size());
+		cb.get_frames(beg, count, buffer.data());
+		push(&s, buffer.data(), count, emit);
+		cb.report_progress(float(beg + count) / float(n));
+	}
+	if (cb.should_abort()) { return poka::result::aborted; }
+	finish(&s, emit);
+	return poka::result::ok;
+}
+
+} // poka
+} // snd
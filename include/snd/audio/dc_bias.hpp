@@ -2,9 +2,18 @@
 
 #include "../ease.hpp"
 #include "../misc.hpp"
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <functional>
 #include <limits>
+#include <utility>
 #include <vector>
 
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
 namespace snd {
 namespace audio {
 namespace dc_bias {
@@ -38,16 +47,53 @@ auto expand_window(size_t frame_count, size_t window_size, detection_window wind
 	return window;
 }
 
+// Eight independent lanes so that the compiler can keep the
+// whole reduction in vector registers even without AVX2
+static constexpr auto MIN_MAX_LANES = size_t(8);
+
 [[nodiscard]] inline
 auto detect_midpoint(dc_bias::const_frames frames, size_t window_size, detection_window window) -> float {
-	float min = std::numeric_limits<float>::max();
-	float max = std::numeric_limits<float>::lowest();
 	// i think this actually makes things worse but it's an interesting idea
 	// window = expand_window(frames.size, window_size, window);
-	for (size_t i = window.beg; i < window.end; i++) {
-		const auto value = frames.floats[i];
-		if (value < min) { min = value; }
-		if (value > max) { max = value; }
+	const auto floats = frames.floats;
+	auto i = window.beg;
+	float min = std::numeric_limits<float>::max();
+	float max = std::numeric_limits<float>::lowest();
+#if defined(__AVX2__)
+	if (window.end - window.beg >= MIN_MAX_LANES) {
+		auto min_v = _mm256_set1_ps(min);
+		auto max_v = _mm256_set1_ps(max);
+		for (; i + MIN_MAX_LANES <= window.end; i += MIN_MAX_LANES) {
+			const auto v = _mm256_loadu_ps(floats + i);
+			min_v = _mm256_min_ps(min_v, v);
+			max_v = _mm256_max_ps(max_v, v);
+		}
+		alignas(32) float mins[MIN_MAX_LANES];
+		alignas(32) float maxs[MIN_MAX_LANES];
+		_mm256_store_ps(mins, min_v);
+		_mm256_store_ps(maxs, max_v);
+		min = *std::min_element(mins, mins + MIN_MAX_LANES);
+		max = *std::max_element(maxs, maxs + MIN_MAX_LANES);
+	}
+#else
+	if (window.end - window.beg >= MIN_MAX_LANES) {
+		float mins[MIN_MAX_LANES];
+		float maxs[MIN_MAX_LANES];
+		std::fill(mins, mins + MIN_MAX_LANES, min);
+		std::fill(maxs, maxs + MIN_MAX_LANES, max);
+		for (; i + MIN_MAX_LANES <= window.end; i += MIN_MAX_LANES) {
+			for (size_t j = 0; j < MIN_MAX_LANES; j++) {
+				mins[j] = std::min(mins[j], floats[i + j]);
+				maxs[j] = std::max(maxs[j], floats[i + j]);
+			}
+		}
+		min = *std::min_element(mins, mins + MIN_MAX_LANES);
+		max = *std::max_element(maxs, maxs + MIN_MAX_LANES);
+	}
+#endif
+	for (; i < window.end; i++) {
+		min = std::min(min, floats[i]);
+		max = std::max(max, floats[i]);
 	}
 	return (min + max) * 0.5f;
 }
@@ -78,6 +124,23 @@ auto get_window_center(size_t window_size, size_t window_count, size_t frame_cou
 	return center;
 }
 
+// Correction value between midpoints a and b, for an already
+// eased position, so that channels can share the easing
+[[nodiscard]] inline
+auto eased_frame_value(float a, float b, float eased_t) -> float {
+	const auto value     = lerp(a, b, eased_t);
+	const auto abs_value = std::abs(value);
+	const auto amount    = abs_value * abs_value * abs_value;
+	return value * amount;
+}
+
+// Correction value at position t (in windows) after the
+// center of the window with midpoint a
+[[nodiscard]] inline
+auto frame_value(float a, float b, float t) -> float {
+	return eased_frame_value(a, b, easing::quadratic::in_out(t));
+}
+
 inline
 auto generate_frame_values(const std::vector<float>& window_midpoints, size_t window_size, std::vector<float>* out) -> void {
 	if (window_midpoints.empty()) {
@@ -103,11 +166,8 @@ auto generate_frame_values(const std::vector<float>& window_midpoints, size_t wi
 		const auto frame_beg = get_window_center(window_size, window_count, frame_count, index);
 		const auto frame_end = get_window_center(window_size, window_count, frame_count, index + 1);
 		for (size_t frame_index = frame_beg; frame_index < frame_end; frame_index++) {
-			const auto t         = static_cast<float>(frame_index - frame_beg) / static_cast<float>(window_size);
-			const auto value     = lerp(window_a_midpoint, window_b_midpoint, easing::quadratic::in_out(t));
-			const auto abs_value = std::abs(value);
-			const auto amount    = abs_value * abs_value * abs_value;
-			(*out)[frame_index] = value * amount;
+			const auto t = static_cast<float>(frame_index - frame_beg) / static_cast<float>(window_size);
+			(*out)[frame_index] = frame_value(window_a_midpoint, window_b_midpoint, t);
 		}
 	}
 	// End
@@ -135,6 +195,212 @@ auto apply_correction(dc_bias::frames frames, const dc_bias::detection& detectio
 	}
 }
 
+// Subtracts the correction for frames [beg, end) straight from
+// the window midpoints. Same result as detect() followed by
+// apply_correction() but without the per-frame vector, and it
+// can be done a chunk at a time.
+inline
+auto apply_correction(dc_bias::frames frames, const std::vector<float>& window_midpoints, size_t window_size, size_t beg, size_t end) -> void {
+	if (window_midpoints.empty()) {
+		return;
+	}
+	const auto window_count = window_midpoints.size();
+	if (window_count == 1) {
+		for (auto i = beg; i < end; i++) {
+			frames.floats[i] -= window_midpoints[0];
+		}
+		return;
+	}
+	const auto center = [&](size_t index) { return detail::get_window_center(window_size, window_count, frames.size, index); };
+	// Beginning
+	for (auto i = beg; i < std::min(end, window_size / 2); i++) {
+		frames.floats[i] -= window_midpoints.front();
+	}
+	// Middle parts. The centers are window_size apart (apart
+	// from the last one) so the first part to touch can be
+	// found directly
+	const auto first = beg > (window_size / 2) ? (beg - (window_size / 2)) / window_size : 0;
+	for (auto index = first; index + 1 < window_count; index++) {
+		const auto frame_beg = center(index);
+		const auto frame_end = center(index + 1);
+		if (frame_beg >= end) {
+			break;
+		}
+		for (auto i = std::max(beg, frame_beg); i < std::min(end, frame_end); i++) {
+			const auto t = static_cast<float>(i - frame_beg) / static_cast<float>(window_size);
+			frames.floats[i] -= detail::frame_value(window_midpoints[index], window_midpoints[index + 1], t);
+		}
+	}
+	// End
+	for (auto i = std::max(beg, center(window_count - 1)); i < end; i++) {
+		frames.floats[i] -= window_midpoints.back();
+	}
+}
+
+// The same for N channels of the same length, each with its
+// own midpoints. The position on the correction curve is only
+// eased once per frame for all of them.
+template <size_t N>
+auto apply_correction(const std::array<dc_bias::frames, N>& frames, const std::array<const std::vector<float>*, N>& window_midpoints, size_t window_size, size_t beg, size_t end) -> void {
+	const auto window_count = window_midpoints[0]->size();
+	if (window_count == 0) {
+		return;
+	}
+	if (window_count == 1) {
+		for (size_t c = 0; c < N; c++) {
+			apply_correction(frames[c], *window_midpoints[c], window_size, beg, end);
+		}
+		return;
+	}
+	const auto center = [&](size_t index) { return detail::get_window_center(window_size, window_count, frames[0].size, index); };
+	// Beginning
+	for (auto i = beg; i < std::min(end, window_size / 2); i++) {
+		for (size_t c = 0; c < N; c++) {
+			frames[c].floats[i] -= window_midpoints[c]->front();
+		}
+	}
+	// Middle parts
+	const auto first = beg > (window_size / 2) ? (beg - (window_size / 2)) / window_size : 0;
+	for (auto index = first; index + 1 < window_count; index++) {
+		const auto frame_beg = center(index);
+		const auto frame_end = center(index + 1);
+		if (frame_beg >= end) {
+			break;
+		}
+		std::array<float, N> a;
+		std::array<float, N> b;
+		for (size_t c = 0; c < N; c++) {
+			a[c] = (*window_midpoints[c])[index];
+			b[c] = (*window_midpoints[c])[index + 1];
+		}
+		for (auto i = std::max(beg, frame_beg); i < std::min(end, frame_end); i++) {
+			const auto t = static_cast<float>(i - frame_beg) / static_cast<float>(window_size);
+			const auto eased_t = easing::quadratic::in_out(t);
+			for (size_t c = 0; c < N; c++) {
+				frames[c].floats[i] -= detail::eased_frame_value(a[c], b[c], eased_t);
+			}
+		}
+	}
+	// End
+	for (auto i = std::max(beg, center(window_count - 1)); i < end; i++) {
+		for (size_t c = 0; c < N; c++) {
+			frames[c].floats[i] -= window_midpoints[c]->back();
+		}
+	}
+}
+
+// Detects and removes the bias in place. Only the window
+// midpoints are kept, so unlike detect() this doesn't need a
+// second buffer the size of the input.
+inline
+auto remove(dc_bias::frames frames, size_t window_size, std::vector<float>* window_midpoints) -> void {
+	detail::detect_midpoints({frames.floats, frames.size}, window_size, window_midpoints);
+	apply_correction(frames, *window_midpoints, window_size, 0, frames.size);
+}
+
+// Realtime bias removal for the audio thread. The midpoint is
+// tracked over a sliding window centered on the output frame
+// (the min and max come from two monotonic queues so it's
+// O(1) per frame on average and never more than O(window_size)
+// for a block) and is corrected with the same curve as
+// detect().
+//
+// The output lags the input by latency() frames. Everything is
+// allocated by make_tracker.
+struct tracker {
+	struct entry {
+		uint64_t frame;
+		float value;
+	};
+	struct queue {
+		std::vector<entry> ring;
+		uint64_t head = 0;
+		uint64_t tail = 0;
+	};
+	size_t window_size = 0;
+	uint64_t frame     = 0;
+	uint64_t mask      = 0;
+	queue min;
+	queue max;
+	std::vector<float> delay;
+	size_t delay_pos = 0;
+};
+
+namespace detail {
+
+[[nodiscard]] inline
+auto correction(float midpoint) -> float {
+	return frame_value(midpoint, midpoint, 0.0f);
+}
+
+// Keeps the queue values monotonic (increasing for the min
+// queue, decreasing for the max queue) so the front is always
+// the extreme of the current window
+template <typename Cmp> inline
+auto push(dc_bias::tracker::queue* q, uint64_t mask, uint64_t window_beg, tracker::entry e, Cmp cmp) -> float {
+	while (q->tail > q->head && !cmp(q->ring[(q->tail - 1) & mask].value, e.value)) {
+		q->tail--;
+	}
+	q->ring[q->tail++ & mask] = e;
+	while (q->ring[q->head & mask].frame < window_beg) {
+		q->head++;
+	}
+	return q->ring[q->head & mask].value;
+}
+
+} // detail
+
+[[nodiscard]] inline
+auto make_tracker(size_t window_size) -> dc_bias::tracker {
+	dc_bias::tracker out;
+	out.window_size = std::max(size_t(1), window_size);
+	size_t capacity = 1;
+	while (capacity < out.window_size + 1) {
+		capacity <<= 1;
+	}
+	out.mask = capacity - 1;
+	out.min.ring.resize(capacity);
+	out.max.ring.resize(capacity);
+	out.delay.resize(out.window_size / 2);
+	return out;
+}
+
+[[nodiscard]] inline
+auto latency(const dc_bias::tracker& t) -> size_t {
+	return t.delay.size();
+}
+
+[[nodiscard]] inline
+auto process(dc_bias::tracker* t, float in) -> float {
+	const auto window_beg = t->frame + 1 > t->window_size ? t->frame + 1 - t->window_size : 0;
+	const auto e          = dc_bias::tracker::entry{t->frame++, in};
+	const auto min        = detail::push(&t->min, t->mask, window_beg, e, std::less<float>{});
+	const auto max        = detail::push(&t->max, t->mask, window_beg, e, std::greater<float>{});
+	auto delayed = in;
+	if (!t->delay.empty()) {
+		delayed = std::exchange(t->delay[t->delay_pos], in);
+		t->delay_pos = t->delay_pos + 1 == t->delay.size() ? 0 : t->delay_pos + 1;
+	}
+	return delayed - detail::correction((min + max) * 0.5f);
+}
+
+// in and out may be the same buffer
+inline
+auto process(dc_bias::tracker* t, const float* in, float* out, size_t count) -> void {
+	for (size_t i = 0; i < count; i++) {
+		out[i] = process(t, in[i]);
+	}
+}
+
+inline
+auto reset(dc_bias::tracker* t) -> void {
+	t->frame = 0;
+	t->min.head = t->min.tail = 0;
+	t->max.head = t->max.tail = 0;
+	std::fill(t->delay.begin(), t->delay.end(), 0.0f);
+	t->delay_pos = 0;
+}
+
 } // dc_bias
 } // audio
 } // snd
@@ -1,9 +1,17 @@
 #pragma once
 
+#include <algorithm>
 #include <array>
+#include <cstdint>
+#include <cmath>
+#include <cstring>
 #include <functional>
 #include <vector>
 
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
 #pragma warning(push, 0)
 #include <DSP/MLDSPGens.h>
 #include <DSP/MLDSPOps.h>
@@ -14,180 +22,432 @@
 namespace snd {
 namespace audio {
 
-template <size_t ROWS>
-class Delay
+namespace detail {
+
+// Number of frames mirrored past the end of the ring so that
+// an interpolation kernel starting anywhere in the ring can
+// read its neighbours without wrapping mid-kernel
+static constexpr uint32_t DELAY_GUARD_FRAMES = 8;
+
+[[nodiscard]] inline
+auto next_pow2(uint32_t x) -> uint32_t
 {
+	uint32_t out = 1;
 
-public:
+	while (out < x) out <<= 1;
 
-	Delay(int SR, size_t size)
-		: SR_(SR)
-		, size_(size)
+	return out;
+}
+
+#if defined(__AVX2__)
+[[nodiscard]] inline
+auto interp_4pt(__m256 p0, __m256 p1, __m256 p2, __m256 p3, __m256 t) -> __m256
+{
+	const auto half = _mm256_set1_ps(0.5f);
+	const auto a = _mm256_mul_ps(half, _mm256_sub_ps(p2, p0));
+	const auto b = _mm256_mul_ps(half, _mm256_sub_ps(p3, p1));
+	const auto c = _mm256_sub_ps(p1, p2);
+	const auto d = _mm256_add_ps(a, c);
+	const auto e = _mm256_add_ps(b, d);
+	const auto f = _mm256_add_ps(c, e);
+	const auto g = _mm256_sub_ps(_mm256_mul_ps(t, f), _mm256_add_ps(d, f));
+
+	return _mm256_add_ps(p1, _mm256_mul_ps(t, _mm256_add_ps(a, _mm256_mul_ps(t, g))));
+}
+#endif
+
+// Reads one DSPVector of 4-point interpolated samples from a
+// power-of-two ring. write_frame is the first frame of the
+// vector which was just written and time must already be
+// clamped to the valid range. The four neighbours of each
+// read are contiguous thanks to the guard region so the
+// only wrapping needed is a mask of the first index.
+inline
+auto read_4pt(const float* buffer, uint32_t mask, uint32_t write_frame, const float* time, float* out) -> void
+{
+	int i = 0;
+
+#if defined(__AVX2__)
+	const auto lane = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+	const auto mask_v = _mm256_set1_epi32(int(mask));
+
+	for (; i < kFloatsPerDSPVector; i += 8)
 	{
-		for (int row = 0; row < ROWS; row++)
-		{
-			buffer_[row].resize(size * kFloatsPerDSPVector);
-		}
+		const auto t = _mm256_loadu_ps(time + i);
+		const auto t_i = _mm256_cvttps_epi32(t);
+		const auto t_f = _mm256_sub_ps(t, _mm256_cvtepi32_ps(t_i));
+		const auto frame = _mm256_add_epi32(_mm256_set1_epi32(int(write_frame) + i - 1), lane);
+		const auto index = _mm256_and_si256(_mm256_sub_epi32(frame, t_i), mask_v);
+		const auto p0 = _mm256_i32gather_ps(buffer + 0, index, 4);
+		const auto p1 = _mm256_i32gather_ps(buffer + 1, index, 4);
+		const auto p2 = _mm256_i32gather_ps(buffer + 2, index, 4);
+		const auto p3 = _mm256_i32gather_ps(buffer + 3, index, 4);
+
+		_mm256_storeu_ps(out + i, interp_4pt(p0, p1, p2, p3, t_f));
 	}
+#endif
 
-	ml::DSPVectorArray<ROWS> operator()(
-		const ml::DSPVectorArray<ROWS>& dry,
-		const ml::DSPVectorArray<ROWS>& time)
+	for (; i < kFloatsPerDSPVector; i++)
 	{
-		write(dry);
+		const auto t_i = uint32_t(time[i]);
+		const auto t_f = time[i] - float(t_i);
+		const auto p = buffer + ((write_frame + uint32_t(i) - 1 - t_i) & mask);
 
-		const auto out = process(time);
+		out[i] = snd::interpolation::interp_4pt(p[0], p[1], p[2], p[3], t_f);
+	}
+}
+
+// Reads one DSPVector one frame at a time using the
+// per-sample read of an interpolation policy. p points at
+// the frame (write_frame + i - floor(time)) and the policy
+// may look BEFORE frames behind it and AFTER frames ahead.
+template <typename Interp>
+auto read_frames(Interp* interp, const float* buffer, uint32_t mask, uint32_t write_frame, const float* time, float* out) -> void
+{
+	for (int i = 0; i < kFloatsPerDSPVector; i++)
+	{
+		const auto t_i = uint32_t(time[i]);
+		const auto t_f = time[i] - float(t_i);
+		const auto p = buffer + ((write_frame + uint32_t(i) - Interp::BEFORE - t_i) & mask) + Interp::BEFORE;
+
+		out[i] = interp->read(p, t_f);
+	}
+}
 
-		advance();
+[[nodiscard]] inline
+auto is_constant_integer(const float* time) -> bool
+{
+	const auto t = time[0];
 
-		return out;
+	if (t != std::floor(t)) return false;
+
+	for (int i = 1; i < kFloatsPerDSPVector; i++)
+	{
+		if (time[i] != t) return false;
 	}
 
-	void clear()
+	return true;
+}
+
+// A delay time which is the same integer for the whole block
+// is just a copy of 64 contiguous frames (in at most two
+// pieces if the read wraps around the end of the ring)
+inline
+auto copy_frames(const float* buffer, uint32_t capacity, uint32_t mask, uint32_t write_frame, uint32_t time, float* out) -> void
+{
+	const auto beg = (write_frame - time) & mask;
+	const auto size = std::min(uint32_t(kFloatsPerDSPVector), capacity - beg);
+
+	std::memcpy(out, buffer + beg, size * sizeof(float));
+	std::memcpy(out + size, buffer, (kFloatsPerDSPVector - size) * sizeof(float));
+}
+
+} // detail
+
+// Interpolation policies for Delay and MultiTapDelay.
+//
+// All of them read the same position for a given delay time
+// so they can be swapped without shifting the output in
+// time. Policies with CAN_COPY reproduce the input exactly
+// at integer delay times which lets the delay skip
+// interpolation entirely for non-modulated blocks.
+namespace delay_interp {
+
+struct none
+{
+	static constexpr uint32_t BEFORE = 0;
+	static constexpr uint32_t AFTER = 0;
+	static constexpr bool CAN_COPY = true;
+
+	float read(const float* p, float) const { return p[0]; }
+
+	void operator()(const float* buffer, uint32_t mask, uint32_t write_frame, const float* time, float* out)
 	{
-		for (int row = 0; row < ROWS; row++)
-		{
-			std::fill(buffer_[row].begin(), buffer_[row].end(), 0.0f);
-		}
+		detail::read_frames(this, buffer, mask, write_frame, time, out);
 	}
+};
 
-private:
+struct linear
+{
+	static constexpr uint32_t BEFORE = 0;
+	static constexpr uint32_t AFTER = 1;
+	static constexpr bool CAN_COPY = true;
+
+	float read(const float* p, float t) const { return p[0] + (t * (p[1] - p[0])); }
 
-	struct DelayTime
+	void operator()(const float* buffer, uint32_t mask, uint32_t write_frame, const float* time, float* out)
 	{
-		ml::DSPVectorArrayInt<ROWS> i;
-		ml::DSPVectorArray<ROWS> f;
-	};
+		detail::read_frames(this, buffer, mask, write_frame, time, out);
+	}
+};
 
-	using InterpFrames = std::array<ml::DSPVectorArrayInt<ROWS>, 4>;
-	using InterpSamples = std::array<ml::DSPVectorArray<ROWS>, 4>;
+struct four_point
+{
+	static constexpr uint32_t BEFORE = 1;
+	static constexpr uint32_t AFTER = 2;
+	static constexpr bool CAN_COPY = true;
 
-	struct InterpSpec
+	void operator()(const float* buffer, uint32_t mask, uint32_t write_frame, const float* time, float* out)
 	{
-		InterpSamples samples;
-		ml::DSPVectorArray<ROWS> f;
-	};
+		detail::read_4pt(buffer, mask, write_frame, time, out);
+	}
+};
 
-	auto get_delay_time(ml::DSPVectorArray<ROWS> time)
+// First order allpass interpolation. It has a flat magnitude
+// response, which suits delays inside feedback loops, but it
+// is stateful and only behaves well when the delay time is
+// modulated slowly. Each row (and each tap) needs its own
+// instance.
+struct allpass
+{
+	static constexpr uint32_t BEFORE = 0;
+	static constexpr uint32_t AFTER = 1;
+	static constexpr bool CAN_COPY = false;
+
+	float read(const float* p, float t)
 	{
-		static const ml::DSPVectorArray<ROWS> min { 2.0f };
-		const ml::DSPVectorArray<ROWS> max { float(size_) * kFloatsPerDSPVector };
+		// Delay of (1 - t) frames behind p[1]
+		const auto a = t / (2.0f - t);
+
+		y_ = (a * p[1]) + p[0] - (a * y_);
+
+		return y_;
+	}
 
-		time = ml::clamp(time, min, max);
+	void operator()(const float* buffer, uint32_t mask, uint32_t write_frame, const float* time, float* out)
+	{
+		detail::read_frames(this, buffer, mask, write_frame, time, out);
+	}
 
-		DelayTime out;
+private:
 
-		out.i = ml::truncateFloatToInt(time);
-		out.f = ml::fractionalPart(time);
+	float y_ { 0.0f };
+};
 
-		return out;
+// 8-point Blackman windowed sinc. The kernel is tabulated
+// at PHASES fractional positions and linearly interpolated
+// between them. The table is shared by all instances and is
+// built the first time one is constructed.
+struct sinc8
+{
+	static constexpr uint32_t BEFORE = 3;
+	static constexpr uint32_t AFTER = 4;
+	static constexpr bool CAN_COPY = true;
+	static constexpr int PHASES = 256;
+
+	using Table = std::array<std::array<float, 8>, PHASES + 1>;
+
+	sinc8() { table(); }
+
+	static const Table& table()
+	{
+		static const Table table = make_table();
+
+		return table;
 	}
 
-	auto get_delayed_frame(const DelayTime& time)
+	float read(const float* p, float t) const
 	{
-		const auto index = ml::truncateFloatToInt(ml::repeatRows<ROWS>(ml::columnIndex()));
-		const auto vector_frame = ml::DSPVectorArrayInt<ROWS>(int(write_vector_) * kFloatsPerDSPVector);
-		const auto just_written_frame = index + vector_frame;
+		const auto& table_ = table();
+		const auto phase = t * PHASES;
+		const auto index = int(phase);
+		const auto x = phase - float(index);
+		const auto& w0 = table_[index];
+		const auto& w1 = table_[index + 1];
+
+		float out = 0.0f;
+
+		for (int k = 0; k < 8; k++)
+		{
+			out += p[k - int(BEFORE)] * (w0[k] + (x * (w1[k] - w0[k])));
+		}
 
-		return just_written_frame - time.i;
+		return out;
 	}
-	
-	auto get_wrapped_frame(const ml::DSPVectorArrayInt<ROWS>& frame)
+
+	void operator()(const float* buffer, uint32_t mask, uint32_t write_frame, const float* time, float* out)
 	{
-		ml::DSPVectorArrayInt<ROWS> out;
+		detail::read_frames(this, buffer, mask, write_frame, time, out);
+	}
 
-		for (int row = 0; row < ROWS; row++)
+private:
+
+	static Table make_table()
+	{
+		constexpr auto pi = 3.14159265358979;
+
+		Table out;
+
+		for (int phase = 0; phase <= PHASES; phase++)
 		{
-			const auto& frame_row = frame.constRow(row);
-			auto& out_row = out.row(row);
+			const auto t = double(phase) / PHASES;
+
+			double sum = 0.0;
 
-			for (int i = 0; i < kFloatsPerDSPVector; i++)
+			for (int k = 0; k < 8; k++)
 			{
-				out_row[i] = frame_row[i];
+				const auto x = double(k - int(BEFORE)) - t;
+				const auto sinc = x == 0.0 ? 1.0 : std::sin(pi * x) / (pi * x);
+				const auto w = (x + 4.0) / 8.0;
+				const auto blackman = 0.42 - (0.5 * std::cos(2.0 * pi * w)) + (0.08 * std::cos(4.0 * pi * w));
 
-				if (out_row[i] < 0)
-				{
-					out_row[i] += int(size_ * kFloatsPerDSPVector);
-				}
+				out[phase][k] = float(sinc * blackman);
+				sum += out[phase][k];
+			}
+
+			for (int k = 0; k < 8; k++)
+			{
+				out[phase][k] = float(out[phase][k] / sum);
 			}
 		}
 
 		return out;
 	}
+};
+
+} // delay_interp
+
+namespace detail {
+
+// The delay memory shared by Delay and MultiTapDelay. The
+// capacity is rounded up to a power of two (with at least
+// one spare vector) so that read positions can be wrapped
+// with a mask instead of a branch
+template <size_t ROWS>
+class DelayRing
+{
 
-	auto get_interp_frames(const DelayTime& time)
+public:
+
+	DelayRing(size_t size)
+		: size_(size)
+		, capacity_(next_pow2(uint32_t((size + 1) * kFloatsPerDSPVector)))
+		, mask_(capacity_ - 1)
 	{
-		const auto delayed_frame = get_delayed_frame(time);
+		for (int row = 0; row < ROWS; row++)
+		{
+			buffer_[row].resize(capacity_ + DELAY_GUARD_FRAMES);
+		}
+	}
 
-		InterpFrames out;
+	void clear()
+	{
+		for (int row = 0; row < ROWS; row++)
+		{
+			std::fill(buffer_[row].begin(), buffer_[row].end(), 0.0f);
+		}
+	}
 
-		out[0] = get_wrapped_frame(delayed_frame - ml::DSPVectorArrayInt<ROWS>(1));
-		out[1] = get_wrapped_frame(delayed_frame);
-		out[2] = get_wrapped_frame(delayed_frame + ml::DSPVectorArrayInt<ROWS>(1));
-		out[3] = get_wrapped_frame(delayed_frame + ml::DSPVectorArrayInt<ROWS>(2));
+	template <typename Interp>
+	auto get_delay_time(const ml::DSPVectorArray<ROWS>& time) const
+	{
+		static const ml::DSPVectorArray<ROWS> min { std::max(2.0f, float(Interp::AFTER)) };
+		const ml::DSPVectorArray<ROWS> max { float(size_) * kFloatsPerDSPVector };
 
-		return out;
+		return ml::clamp(time, min, max);
 	}
 
-	auto get_interp_samples(const InterpFrames& frames)
+	// time must come from get_delay_time()
+	template <typename Interp>
+	auto read(const ml::DSPVectorArray<ROWS>& time, std::array<Interp, ROWS>* interp) const
 	{
-		InterpSamples out;
+		ml::DSPVectorArray<ROWS> out;
 
-		for (int part = 0; part < 4; part++)
+		for (int row = 0; row < ROWS; row++)
 		{
-			for (int row = 0; row < ROWS; row++)
-			{
-				const auto& buffer_row = buffer_[row];
-				const auto& frames_row = frames[part].constRow(row);
-				auto& out_row = out[part].row(row);
+			const auto time_row = time.constRow(row).getConstBuffer();
+			const auto out_row = out.row(row).getBuffer();
 
-				for (int i = 0; i < kFloatsPerDSPVector; i++)
+			if constexpr (Interp::CAN_COPY)
+			{
+				if (is_constant_integer(time_row))
 				{
-					const auto frame = frames_row[i];
-
-					out[part].row(row)[i] = buffer_row[frame];
+					copy_frames(buffer_[row].data(), capacity_, mask_, write_frame_, uint32_t(time_row[0]), out_row);
+					continue;
 				}
 			}
+
+			(*interp)[row](buffer_[row].data(), mask_, write_frame_, time_row, out_row);
 		}
 
 		return out;
 	}
 
-	auto get_delayed_signal(const DelayTime& time)
+	void write(const ml::DSPVectorArray<ROWS>& dry)
 	{
-		ml::DSPVectorArray<ROWS> out;
+		for (int row = 0; row < ROWS; row++)
+		{
+			auto& buffer_row = buffer_[row];
 
-		const auto interp_frames = get_interp_frames(time);
-		const auto interp_samples = get_interp_samples(interp_frames);
+			ml::store(dry.constRow(row), buffer_row.data() + write_frame_);
 
-		return snd::interpolation::interp_4pt(interp_samples[0], interp_samples[1], interp_samples[2], interp_samples[3], time.f);
+			if (write_frame_ == 0)
+			{
+				std::copy(buffer_row.begin(), buffer_row.begin() + DELAY_GUARD_FRAMES, buffer_row.begin() + capacity_);
+			}
+		}
 	}
 
-	void write(const ml::DSPVectorArray<ROWS>& dry)
+	void advance()
 	{
-		for (int row = 0; row < ROWS; row++)
-		{
-			ml::store(dry.constRow(row), buffer_[row].data() + (write_vector_ * kFloatsPerDSPVector));
-		}
+		write_frame_ = (write_frame_ + kFloatsPerDSPVector) & mask_;
 	}
 
-	ml::DSPVectorArray<ROWS> process(const ml::DSPVectorArray<ROWS>& time)
+private:
+
+	uint32_t write_frame_ { 0 };
+	size_t size_;
+	uint32_t capacity_;
+	uint32_t mask_;
+	std::array<std::vector<float>, ROWS> buffer_;
+};
+
+} // detail
+
+template <size_t ROWS, typename Interp = delay_interp::four_point>
+class Delay
+{
+
+public:
+
+	Delay(int SR, size_t size)
+		: SR_(SR)
+		, ring_(size)
 	{
-		const auto delay_time = get_delay_time(time);
-		const auto delayed_signal = get_delayed_signal(delay_time);
+	}
 
-		return delayed_signal;
+	ml::DSPVectorArray<ROWS> operator()(
+		const ml::DSPVectorArray<ROWS>& dry,
+		const ml::DSPVectorArray<ROWS>& time)
+	{
+		ring_.write(dry);
+
+		const auto out = process(time);
+
+		ring_.advance();
+
+		return out;
 	}
 
-	void advance()
+	void clear()
 	{
-		if (++write_vector_ >= size_) write_vector_ = 0;
+		ring_.clear();
+		interp_ = {};
+	}
+
+private:
+
+	ml::DSPVectorArray<ROWS> process(const ml::DSPVectorArray<ROWS>& time)
+	{
+		const auto delay_time = ring_.template get_delay_time<Interp>(time);
+		const auto delayed_signal = ring_.read(delay_time, &interp_);
+
+		return delayed_signal;
 	}
 
 	int SR_ { 44100 };
-	size_t write_vector_ { 0 };
-	size_t size_;
-	std::array<std::vector<float>, ROWS> buffer_;
+	detail::DelayRing<ROWS> ring_;
+	std::array<Interp, ROWS> interp_;
 };
 
 } // audio
@@ -0,0 +1,246 @@
+#pragma once
+
+#include <array>
+#include <cmath>
+#include <vector>
+
+#pragma warning(push, 0)
+#include <DSP/MLDSPOps.h>
+#pragma warning(pop)
+
+#include "delay.hpp"
+#include "filter/1-pole.hpp"
+
+namespace snd {
+namespace audio {
+
+enum class FDNMatrix
+{
+	Hadamard,
+	Householder,
+};
+
+//
+// N-line feedback delay network for reverbs.
+//
+// All delay lines live in one allocation, one power-of-two
+// ring per line laid out back to back. Every line is at least
+// one DSPVector long so a whole block can be read before any
+// of it is written back, which means the network runs a block
+// at a time: each line is a row of a DSPVectorArray<N> and the
+// mixing matrix, damping and gains are applied to whole rows.
+//
+template <size_t N, FDNMatrix MATRIX = FDNMatrix::Hadamard>
+class FDN
+{
+	static_assert(N >= 2 && (N & (N - 1)) == 0, "FDN line count must be a power of two");
+
+public:
+
+	using Lines = ml::DSPVectorArray<N>;
+	using Times = std::array<float, N>;
+
+	FDN(int SR, size_t max_delay_frames)
+		: SR_(SR)
+		, max_delay_(std::max(size_t(kFloatsPerDSPVector), max_delay_frames))
+		, capacity_(detail::next_pow2(uint32_t(max_delay_ + kFloatsPerDSPVector)))
+		, mask_(capacity_ - 1)
+		, buffer_(N * capacity_, 0.0f)
+	{
+		set_delay_times(make_delay_times(float(kFloatsPerDSPVector), float(max_delay_)));
+	}
+
+	// Geometrically spaced delay times between min and max,
+	// rounded to odd frame counts to avoid the most obvious
+	// common factors between lines. Even counts are rounded up
+	// unless that would go past max. No line is shorter than a
+	// DSPVector.
+	static Times make_delay_times(float min, float max)
+	{
+		Times out;
+
+		min = std::max(min, float(kFloatsPerDSPVector));
+		max = std::max(max, min);
+
+		for (size_t line = 0; line < N; line++)
+		{
+			const auto x = float(line) / float(N - 1);
+			auto frames = std::floor(min * std::pow(max / min, x));
+
+			if (std::fmod(frames, 2.0f) == 0.0f)
+			{
+				if (frames + 1.0f <= max) frames += 1.0f;
+				else if (frames - 1.0f >= min) frames -= 1.0f;
+			}
+
+			out[line] = frames;
+		}
+
+		return out;
+	}
+
+	// Delay times are in frames and are clamped to
+	// [kFloatsPerDSPVector, max_delay_frames]
+	void set_delay_times(const Times& frames)
+	{
+		for (size_t line = 0; line < N; line++)
+		{
+			const auto t = std::clamp(std::floor(frames[line]), float(kFloatsPerDSPVector), float(max_delay_));
+
+			times_[line] = uint32_t(t);
+		}
+
+		update_gains();
+	}
+
+	// Time in seconds for the tail to decay by 60dB
+	void set_decay(float rt60)
+	{
+		rt60_ = std::max(0.001f, rt60);
+
+		update_gains();
+	}
+
+	// Cutoff of the 1-pole lowpass in each feedback path
+	void set_damping(float freq)
+	{
+		damping_ = Lines { freq };
+	}
+
+	void clear()
+	{
+		std::fill(buffer_.begin(), buffer_.end(), 0.0f);
+
+		damping_filter_.clear();
+	}
+
+	// Stereo in, stereo wet out
+	ml::DSPVectorArray<2> operator()(const ml::DSPVectorArray<2>& in)
+	{
+		auto lines = read();
+
+		ml::DSPVectorArray<2> out { 0.0f };
+
+		for (size_t line = 0; line < N; line++)
+		{
+			const auto sign = (line / 2) % 2 == 0 ? 1.0f : -1.0f;
+
+			out.row(line % 2) += lines.constRow(line) * ml::DSPVector(sign);
+		}
+
+		out = out * ml::DSPVectorArray<2>(OUTPUT_SCALE);
+
+		mix(&lines);
+
+		damping_filter_(lines, SR_, damping_);
+
+		lines = damping_filter_.lp() * gains_;
+
+		for (size_t line = 0; line < N; line++)
+		{
+			const auto sign = (line / 2) % 2 == 0 ? 1.0f : -1.0f;
+
+			lines.row(line) += in.constRow(line % 2) * ml::DSPVector(sign * INPUT_SCALE);
+		}
+
+		write(lines);
+
+		write_frame_ = (write_frame_ + kFloatsPerDSPVector) & mask_;
+
+		return out;
+	}
+
+private:
+
+	static constexpr float INPUT_SCALE = 1.0f / float(N / 2);
+	static constexpr float OUTPUT_SCALE = 2.0f / float(N);
+
+	Lines read() const
+	{
+		Lines out;
+
+		for (size_t line = 0; line < N; line++)
+		{
+			detail::copy_frames(buffer_.data() + (line * capacity_), capacity_, mask_, write_frame_, times_[line], out.row(line).getBuffer());
+		}
+
+		return out;
+	}
+
+	void write(const Lines& lines)
+	{
+		for (size_t line = 0; line < N; line++)
+		{
+			ml::store(lines.constRow(line), buffer_.data() + (line * capacity_) + write_frame_);
+		}
+	}
+
+	// Both matrices are orthogonal (scaled to be lossless) so
+	// the decay is set entirely by the per-line gains
+	static void mix(Lines* lines)
+	{
+		if constexpr (MATRIX == FDNMatrix::Hadamard)
+		{
+			// Fast Walsh-Hadamard transform, log2(N) stages of
+			// butterflies between whole rows
+			for (size_t h = 1; h < N; h *= 2)
+			{
+				for (size_t i = 0; i < N; i += h * 2)
+				{
+					for (size_t j = i; j < i + h; j++)
+					{
+						const auto a = lines->constRow(j);
+						const auto b = lines->constRow(j + h);
+
+						lines->row(j) = a + b;
+						lines->row(j + h) = a - b;
+					}
+				}
+			}
+
+			*lines = *lines * Lines(1.0f / std::sqrt(float(N)));
+		}
+		else
+		{
+			// I - (2/N) * ones
+			ml::DSPVector sum { 0.0f };
+
+			for (size_t line = 0; line < N; line++)
+			{
+				sum += lines->constRow(line);
+			}
+
+			sum = sum * ml::DSPVector(2.0f / float(N));
+
+			for (size_t line = 0; line < N; line++)
+			{
+				lines->row(line) -= sum;
+			}
+		}
+	}
+
+	void update_gains()
+	{
+		for (size_t line = 0; line < N; line++)
+		{
+			const auto gain = std::pow(10.0f, (-3.0f * float(times_[line])) / (rt60_ * float(SR_)));
+
+			gains_.row(line) = ml::DSPVector(gain);
+		}
+	}
+
+	int SR_ { 44100 };
+	size_t max_delay_;
+	uint32_t capacity_;
+	uint32_t mask_;
+	uint32_t write_frame_ { 0 };
+	float rt60_ { 2.0f };
+	std::array<uint32_t, N> times_;
+	std::vector<float> buffer_;
+	Lines gains_ { 0.0f };
+	Lines damping_ { 8000.0f };
+	filter::Filter_1Pole<int(N)> damping_filter_;
+};
+
+} // audio
+} // snd
\ No newline at end of file
@@ -2,6 +2,8 @@
 
 #include <array>
 #include <functional>
+#include <tuple>
+#include <utility>
 
 #pragma warning(push, 0)
 #include <DSP/MLDSPFilters.h>
@@ -12,6 +14,44 @@
 namespace snd {
 namespace audio {
 
+// Insert effect which leaves the feedback signal untouched
+struct InsertPassthrough {
+	template <typename T>
+	const T& operator()(const T& x) const { return x; }
+};
+
+// Composes several insert effects into one at compile time.
+// The effects are applied in the order they were given, each
+// one receiving the output of the previous one. Effects are
+// stored by value, so wrap stateful effects which live
+// elsewhere in std::ref.
+template <typename... Effects>
+struct InsertChain {
+	std::tuple<Effects...> effects;
+
+	template <typename T>
+	auto operator()(const T& x) -> T {
+		return apply<0>(x);
+	}
+
+private:
+
+	template <size_t I, typename T>
+	auto apply(const T& x) -> T {
+		if constexpr (I == sizeof...(Effects)) {
+			return x;
+		}
+		else {
+			return apply<I + 1>(T(std::get<I>(effects)(x)));
+		}
+	}
+};
+
+template <typename... Effects>
+auto make_insert_chain(Effects... effects) -> InsertChain<Effects...> {
+	return { { std::move(effects)... } };
+}
+
 template <size_t ROWS>
 class FeedbackDelay {
 public: 
@@ -38,11 +78,45 @@ public:
 		feedback_ = { 0.0f };
 	}
 
+	ml::DSPVectorArray<ROWS> operator()(
+		const ml::DSPVectorArray<ROWS>& dry,
+		const ml::DSPVectorArray<ROWS>& time,
+		const ml::DSPVectorArray<ROWS>& feedback_amount)
+	{
+		return process(dry, time, feedback_amount, InsertPassthrough{});
+	}
+
+	// Type-erased insert effect. Prefer passing the callable
+	// directly so that it can be inlined
 	ml::DSPVectorArray<ROWS> operator()(
 		const ml::DSPVectorArray<ROWS>& dry,
 		const ml::DSPVectorArray<ROWS>& time,
 		const ml::DSPVectorArray<ROWS>& feedback_amount,
-		InsertEffect insert_effect = [](const ml::DSPVectorArray<ROWS>& x) { return x; })
+		const InsertEffect& insert_effect)
+	{
+		return process(dry, time, feedback_amount, insert_effect);
+	}
+
+	// The insert effect can be any callable (or an InsertChain)
+	// taking and returning a DSPVectorArray<ROWS>
+	template <typename InsertEffectFn>
+	ml::DSPVectorArray<ROWS> operator()(
+		const ml::DSPVectorArray<ROWS>& dry,
+		const ml::DSPVectorArray<ROWS>& time,
+		const ml::DSPVectorArray<ROWS>& feedback_amount,
+		InsertEffectFn&& insert_effect)
+	{
+		return process(dry, time, feedback_amount, insert_effect);
+	}
+
+private:
+
+	template <typename InsertEffectFn>
+	ml::DSPVectorArray<ROWS> process(
+		const ml::DSPVectorArray<ROWS>& dry,
+		const ml::DSPVectorArray<ROWS>& time,
+		const ml::DSPVectorArray<ROWS>& feedback_amount,
+		InsertEffectFn&& insert_effect)
 	{
 		const auto delay_in { dry + (feedback_ * feedback_amount) };
 
@@ -59,8 +133,6 @@ public:
 		return delay_out;
 	}
 
-private:
-
 	std::array<ml::PitchbendableDelay, ROWS> delays_;
 
 	float size_;
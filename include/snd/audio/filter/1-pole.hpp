@@ -28,8 +28,8 @@ public:
 
 	Filter_1Pole();
 
-	const ml::DSPVectorArray<2>& lp() const { return lp_; }
-	const ml::DSPVectorArray<2>& hp() const { return hp_; }
+	const ml::DSPVectorArray<ROWS>& lp() const { return lp_; }
+	const ml::DSPVectorArray<ROWS>& hp() const { return hp_; }
 
 	void operator()(const ml::DSPVectorArray<ROWS>& in);
 	void operator()(const ml::DSPVectorArray<ROWS>& in, int SR, const ml::DSPVectorArray<ROWS>& freq);
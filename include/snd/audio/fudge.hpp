@@ -3,7 +3,8 @@
 #include "../ease.hpp"
 #include "../frame-pos.hpp"
 #include "../misc.hpp"
-#include "autocorrelation.hpp"
+#include "autocorrelation_compact.hpp"
+#include <algorithm>
 #include <array>
 #pragma warning(push, 0)
 #include <DSP/MLDSPOps.h>
@@ -46,7 +47,10 @@ struct vector_info {
 	fudge::size size;
 	fudge::SR SR;
 	fudge::uniformity uniformity;
+	// One per channel. If compact_analysis is set it is used
+	// instead of analysis.
 	const poka::output* analysis = nullptr;
+	const poka::compact_output* compact_analysis = nullptr;
 };
 
 struct frame_info {
@@ -54,6 +58,10 @@ struct frame_info {
 	int idx;
 };
 
+struct vector_flags {
+	std::array<fudge::frame_flags, kFloatsPerDSPVector> value;
+};
+
 struct flip_flop { uint8_t value = 0; };
 
 struct grain {
@@ -97,23 +105,27 @@ auto flip(fudge::flip_flop x) -> fudge::flip_flop {
 }
 
 [[nodiscard]] inline
-auto adjusted_channel_pos(fudge::particle* p, const fudge::vector_info& v, fudge::frame_info f, int channel) -> float {
+auto estimated_size(const fudge::vector_info& v, int channel, size_t frame) -> float {
+	return v.compact_analysis
+		? poka::estimated_size(v.compact_analysis[channel], frame)
+		: poka::estimated_size(v.analysis[channel], frame);
+}
+
+// other is the grain to line the new one up with. Anything with
+// a beg and a frame will do.
+template <typename Grain> [[nodiscard]]
+auto adjusted_channel_pos(const fudge::vector_info& v, fudge::frame_info f, int channel, const Grain& other) -> float {
 	const auto pos = float(v.sample_position.value[f.idx]);
 	const auto adjust_amount = 1.0f - v.uniformity.value[f.idx];
 	if (adjust_amount < 0.000001f) return pos; 
 	if (pos > v.sample_frame_count.value) return pos; 
-	if (!v.analysis) return pos;
-	const auto& other = other_grain(p, p->flip_flop.value);
+	if (!v.analysis && !v.compact_analysis) return pos;
 	const auto other_pos = other.beg[channel];
 	if (other_pos + other.frame < 0.0f) return pos;
 	const auto other_pos_floor = int(std::floor(other_pos + other.frame));
 	const auto diff = pos - (other_pos + other.frame);
 	const auto abs_diff = std::abs(diff);
-	const auto& channel_analysis_data = v.analysis[channel].frames.estimated_size;
-	const auto other_wavecycle =
-		other_pos_floor >= channel_analysis_data.size()
-			? channel_analysis_data[channel_analysis_data.size() - 1]
-			: channel_analysis_data[other_pos_floor];
+	const auto other_wavecycle = estimated_size(v, channel, size_t(other_pos_floor));
 	const auto a = int(std::floor(float(abs_diff) / other_wavecycle));
 	float adjusted_pos;
 	if (diff > 0.0f) {
@@ -128,8 +140,8 @@ auto adjusted_channel_pos(fudge::particle* p, const fudge::vector_info& v, fudge
 	return lerp(pos, adjusted_pos, adjust_amount);
 }
 
-[[nodiscard]] inline
-auto get_stereo_positions(fudge::particle* p, const fudge::vector_info& v, fudge::frame_info f, bool adjust) -> stereo_frame {
+template <typename Grain> [[nodiscard]]
+auto get_stereo_positions(const fudge::vector_info& v, fudge::frame_info f, bool adjust, const Grain& other) -> stereo_frame {
 	const auto pos = float(v.sample_position.value[f.idx]);
 	if (!adjust) {
 		return { pos, pos };
@@ -140,18 +152,18 @@ auto get_stereo_positions(fudge::particle* p, const fudge::vector_info& v, fudge
 	stereo_frame out;
 	switch (v.channel_mode) {
 		case channel_mode::stereo: {
-			out.L = adjusted_channel_pos(p, v, f, 0);
-			out.R = adjusted_channel_pos(p, v, f, 1);
+			out.L = adjusted_channel_pos(v, f, 0, other);
+			out.R = adjusted_channel_pos(v, f, 1, other);
 			break;
 		} 
 		case channel_mode::left: {
-			out.L = adjusted_channel_pos(p, v, f, 0);
-			out.R = adjusted_channel_pos(p, v, f, 0);
+			out.L = adjusted_channel_pos(v, f, 0, other);
+			out.R = adjusted_channel_pos(v, f, 0, other);
 			break;
 		} 
 		case channel_mode::right: {
-			out.L = adjusted_channel_pos(p, v, f, 1);
-			out.R = adjusted_channel_pos(p, v, f, 1);
+			out.L = adjusted_channel_pos(v, f, 1, other);
+			out.R = adjusted_channel_pos(v, f, 1, other);
 			break;
 		}
         default: break;
@@ -162,8 +174,8 @@ auto get_stereo_positions(fudge::particle* p, const fudge::vector_info& v, fudge
 	return out;
 }
 
-[[nodiscard]] inline
-auto get_mono_position(fudge::particle* p, const fudge::vector_info& v, fudge::frame_info f, bool adjust) -> float {
+template <typename Grain> [[nodiscard]]
+auto get_mono_position(const fudge::vector_info& v, fudge::frame_info f, bool adjust, const Grain& other) -> float {
 	const auto pos = float(v.sample_position.value[f.idx]);
 	if (!adjust) {
 		return pos;
@@ -171,23 +183,27 @@ auto get_mono_position(fudge::particle* p, const fudge::vector_info& v, fudge::f
 	if (pos <= 0.0f) {
 		return pos; 
 	}
-	return adjusted_channel_pos(p, v, f, 0);
+	return adjusted_channel_pos(v, f, 0, other);
 }
 
+// Start positions of a new grain, for both channels
+template <typename Grain> [[nodiscard]]
+auto get_positions(const fudge::vector_info& v, fudge::frame_info f, bool adjust, const Grain& other) -> stereo_frame {
+	if (v.channel_count.value > 1) {
+		return get_stereo_positions(v, f, adjust, other);
+	}
+	const auto pos = get_mono_position(v, f, adjust, other);
+	return {pos, pos};
+}
+
+static constexpr auto MIN_GRAIN_SIZE  = 3.0f;
+static constexpr auto MAX_WINDOW_SIZE = 4096.0f;
+
 inline
 auto trigger_next_grain(fudge::particle* p, const fudge::vector_info& v, fudge::frame_info f, bool adjust) -> void {
-	constexpr auto MIN_GRAIN_SIZE = 3.0f;
-	constexpr auto MAX_WINDOW_SIZE = 4096.0f;
 	p->flip_flop       = flip(p->flip_flop);
 	const auto fade_in = v.sample_position.value[f.idx] > frame_pos{0};
-	stereo_frame beg;
-	if (v.channel_count.value > 1) {
-		beg = get_stereo_positions(p, v, f, adjust);
-	}
-	else {
-		beg.L = get_mono_position(p, v, f, adjust);
-		beg.R = beg.L;
-	}
+	const auto beg     = get_positions(v, f, adjust, other_grain(p, p->flip_flop.value));
 	auto ratio = v.harmonic_ratio.value[f.idx];
 	auto ff    = v.ff.value[f.idx];
 	auto size  = std::max(MIN_GRAIN_SIZE, v.size.value[f.idx] * ff);
@@ -212,14 +228,14 @@ auto reset(fudge::particle* p, const fudge::vector_info& v, fudge::frame_info f)
 	trigger_next_grain(p, v, f, false);
 }
 
-template <typename ReadSampleFn> [[nodiscard]]
-auto read_mono_frame(const fudge::particle& p, ReadSampleFn read_sample_fn, const fudge::grain& grain) -> float {
+template <typename ReadSampleFn, typename Grain> [[nodiscard]]
+auto read_mono_frame(ReadSampleFn read_sample_fn, const Grain& grain) -> float {
 	const auto pos = grain.beg[0] + grain.frame;
 	return pos < 0.f ? 0.f : read_sample_fn(0, pos);
 }
 
-template <typename ReadSampleFn> [[nodiscard]]
-auto read_stereo_frame(const fudge::particle& p, const fudge::vector_info& v, ReadSampleFn read_sample_fn, const fudge::grain& grain) -> stereo_frame {
+template <typename ReadSampleFn, typename Grain> [[nodiscard]]
+auto read_stereo_frame(const fudge::vector_info& v, ReadSampleFn read_sample_fn, const Grain& grain) -> stereo_frame {
 	stereo_frame out;
 	switch (v.channel_mode) {
 		default:
@@ -253,13 +269,10 @@ auto read_stereo_frame(const fudge::particle& p, const fudge::vector_info& v, Re
 	return out;
 }
 
-} // detail
-
-template <typename ReadSampleFn> [[nodiscard]]
-auto process(fudge::particle* p, const fudge::vector_info& v, fudge::frame_info f, ReadSampleFn read_sample_fn) -> stereo_frame {
-	stereo_frame out;
-	const auto play  = detail::is_flag_set(f.flags, f.flags.play);
-	const auto reset = detail::is_flag_set(f.flags, f.flags.reset);
+inline
+auto update_triggers(fudge::particle* p, const fudge::vector_info& v, fudge::frame_info f) -> void {
+	const auto play  = is_flag_set(f.flags, f.flags.play);
+	const auto reset = is_flag_set(f.flags, f.flags.reset);
 	if (p->trig_primed && play) {
 		detail::reset(p, v, f);
 	}
@@ -271,44 +284,435 @@ auto process(fudge::particle* p, const fudge::vector_info& v, fudge::frame_info
 		else if(p->trigger_timer >= std::floor(p->grains[p->flip_flop.value].size / 2)) {
 			if (play) {
 				p->trigger_timer = 0.f;
-				detail::trigger_next_grain(p, v, f, true);
+				trigger_next_grain(p, v, f, true);
+			}
+		}
+	}
+}
+
+// Loops over runs go a chunk of frames at a time, so that each
+// inner loop has a fixed length, which GCC needs to vectorize it
+// at -O2, but a short run still only costs a chunk or two.
+static constexpr auto CHUNK_SIZE = 16;
+
+[[nodiscard]] inline auto chunk_floor(int i) -> int { return i - (i % CHUNK_SIZE); }
+[[nodiscard]] inline auto chunk_ceil(int i) -> int  { return chunk_floor(i + CHUNK_SIZE - 1); }
+
+// The first frame after beg which update_triggers would do
+// anything on, or kFloatsPerDSPVector if there isn't one. The
+// trigger timer is timer at beg and goes up by ff each frame.
+// trigger_at is the timer value for the next grain.
+[[nodiscard]] inline
+auto find_trigger(const fudge::vector_flags& flags, size_t beg, bool primed, float timer, float ff, float trigger_at) -> size_t {
+	const auto run_beg = int(beg);
+	const auto prime   = int(primed);
+	for (auto c = chunk_floor(run_beg); c < kFloatsPerDSPVector; c += CHUNK_SIZE) {
+		auto out = kFloatsPerDSPVector;
+		for (int j = 0; j < CHUNK_SIZE; j++) {
+			const auto i     = c + j;
+			const auto f     = flags.value[i].value;
+			// 0 or 1, without going through bool, which GCC can't
+			// vectorize here
+			const auto play  = (f & frame_flags::play) / frame_flags::play;
+			const auto reset = (f & frame_flags::reset) / frame_flags::reset;
+			const auto due   = prime | int(timer + (ff * float(i - run_beg)) >= trigger_at);
+			const auto found = int(i > run_beg) & (reset | (play & due));
+			// i if found, otherwise kFloatsPerDSPVector
+			out = std::min(out, (-found & (i - kFloatsPerDSPVector)) + kFloatsPerDSPVector);
+		}
+		if (out < kFloatsPerDSPVector) {
+			return size_t(out);
+		}
+	}
+	return kFloatsPerDSPVector;
+}
+
+// True if every frame just plays, which is the usual case
+[[nodiscard]] inline
+auto only_play(const fudge::vector_flags& flags) -> bool {
+	auto other = 0;
+	for (int i = 0; i < kFloatsPerDSPVector; i++) {
+		other |= flags.value[i].value ^ frame_flags::play;
+	}
+	return other == 0;
+}
+
+// find_trigger() for when every frame just plays and ff is
+// positive. The timer then only goes up, so this can guess the
+// frame and step to the right one from there.
+[[nodiscard]] inline
+auto find_due(size_t beg, bool primed, float timer, float ff, float trigger_at) -> size_t {
+	const auto limit = int(kFloatsPerDSPVector) - int(beg);
+	const auto due   = [=](int n) { return primed || timer + (ff * float(n)) >= trigger_at; };
+	auto n = int(std::clamp((trigger_at - timer) / ff, 1.f, float(limit)));
+	while (n > 1 && due(n - 1))  { n--; }
+	while (n < limit && !due(n)) { n++; }
+	return beg + size_t(n);
+}
+
+// Updates the fades of a grain which is on and returns its
+// amplitude for the current frame
+[[nodiscard]] inline
+auto grain_amp(fudge::particle* p, size_t grain_idx, float amp) -> float {
+	auto& grain = p->grains[grain_idx];
+	if (grain.frame < grain.window) {
+		if (grain.fade_in) {
+			grain.frame_amp = easing::quadratic::in_out(1.f - ((grain.window - grain.frame) / grain.window)); 
+			float other_grain_duck = 1.f - grain.frame_amp; 
+			other_grain(p, grain_idx).duck = other_grain_duck;
+		}
+	} 
+	float self_duck = 1.f; 
+	if (grain.frame > grain.size - grain.window) {
+		self_duck = easing::quadratic::in_out(1.f - ((grain.frame - (grain.size - grain.window)) / grain.window));
+	} 
+	auto final_duck = std::min(grain.duck, self_duck);
+	return grain.frame_amp * final_duck * amp;
+}
+
+template <typename Grain>
+auto advance(Grain* grain) -> void {
+	grain->frame += grain->ff; 
+	if (grain->frame >= grain->size) {
+		grain->on = false;
+	} 
+}
+
+// One grain over a run of frames. Index i is frame i of the
+// vector. Only the frames in [beg, end) are heard, and the
+// positions (one per channel) are valid for all of those. There
+// is room for a chunk past the end of the vector, for loops
+// which go a whole chunk at a time.
+struct grain_run {
+	std::array<std::array<float, kFloatsPerDSPVector + CHUNK_SIZE>, 2> pos;
+	std::array<float, kFloatsPerDSPVector + CHUNK_SIZE> amp = {};
+	size_t beg = kFloatsPerDSPVector;
+	size_t end = 0;
+};
+
+// Reads one channel of a run in one go. Nothing is read
+// before the start of the sample. negative is true if any of
+// the positions might be negative.
+template <typename ReadSamplesFn> inline
+auto read_run(ReadSamplesFn read_samples_fn, int channel, const grain_run& run, bool negative, float* out) -> void {
+	const auto& pos = run.pos[channel];
+	if (!negative) {
+		read_samples_fn(channel, pos.data() + run.beg, run.end - run.beg, out + run.beg);
+		return;
+	}
+	std::array<float, kFloatsPerDSPVector> clamped;
+	for (auto i = run.beg; i < run.end; i++) {
+		clamped[i] = std::max(0.f, pos[i]);
+	}
+	read_samples_fn(channel, clamped.data() + run.beg, run.end - run.beg, out + run.beg);
+	for (auto i = run.beg; i < run.end; i++) {
+		out[i] = pos[i] < 0.f ? 0.f : out[i];
+	}
+}
+
+template <typename ReadSamplesFn> inline
+auto read_run(ReadSamplesFn read_samples_fn, int channel, const grain_run& run, float* out) -> void {
+	const auto& pos = run.pos[channel];
+	auto negative = false;
+	for (auto i = run.beg; i < run.end; i++) {
+		negative |= pos[i] < 0.f;
+	}
+	read_run(read_samples_fn, channel, run, negative, out);
+}
+
+// Reads each channel the source needs with read(channel, out),
+// into L, and into R if the source is stereo. Returns false if
+// it is mono, in which case L is used for both sides.
+template <typename ReadFn> inline
+auto read_channels(const fudge::vector_info& v, ReadFn read, float* L, float* R) -> bool {
+	if (v.channel_count.value > 1) {
+		switch (v.channel_mode) {
+			default:
+			case channel_mode::stereo: {
+				read(0, L);
+				read(1, R);
+				return true;
+			}
+			case channel_mode::stereo_swap: {
+				read(0, R);
+				read(1, L);
+				return true;
+			}
+			case channel_mode::left: {
+				read(0, L);
+				return false;
+			}
+			case channel_mode::right: {
+				read(1, L);
+				return false;
 			}
 		}
 	}
+	read(0, L);
+	return false;
+}
+
+template <typename ReadSamplesFn> inline
+auto render_run(const fudge::vector_info& v, ReadSamplesFn read_samples_fn, const grain_run& run, float* out_L, float* out_R) -> void {
+	if (run.beg >= run.end) {
+		return;
+	}
+	std::array<float, kFloatsPerDSPVector> L;
+	std::array<float, kFloatsPerDSPVector> R;
+	const auto read = [read_samples_fn, &run](int channel, float* out) {
+		read_run(read_samples_fn, channel, run, out);
+	};
+	const auto& R_in = read_channels(v, read, L.data(), R.data()) ? R : L;
+	for (auto i = run.beg; i < run.end; i++) {
+		out_L[i] += L[i] * run.amp[i];
+		out_R[i] += R_in[i] * run.amp[i];
+	}
+}
+
+// easing::quadratic::in_out() without the branch, so that loops
+// over it can be vectorized. The results are the same.
+[[nodiscard]] inline
+auto in_out(float x) -> float {
+	x /= 0.5f;
+	const auto y = x - 1.f;
+	return select(x < 1.f, x * x * 0.5f, (y * (y - 2.f) - 1.f) * -0.5f);
+}
+
+// One grain over the runs of a vector. Index i is frame i of the
+// vector.
+struct grain_ramp {
+	// The parts of grain_amp() which only depend on this grain,
+	// for the current run. fade is only filled in as far as the
+	// grain fades in.
+	std::array<float, kFloatsPerDSPVector + CHUNK_SIZE> fade = {};
+	std::array<float, kFloatsPerDSPVector + CHUNK_SIZE> self_duck;
+	// The grain is on for this many frames from the start of
+	// the current run, and fading in for the first fading of them
+	int on_count = 0;
+	int fading   = 0;
+	// Nonzero for each channel if any position is negative
+	std::array<int, 2> negative = {};
+	// Filled in by each run in turn. The amp is zero where the
+	// grain is off.
+	grain_run run;
+};
+
+// Both grains, and v.amp with room for a chunk past the end of
+// the vector. Everything is kept together so that the compiler
+// can see that the arrays don't overlap, which it has to know to
+// vectorize the loops over them.
+struct vector_ramps {
+	std::array<float, kFloatsPerDSPVector + CHUNK_SIZE> amp;
+	std::array<grain_ramp, 2> grains;
+};
+
+// Works out a grain's ramp for the frames [beg, end), which have
+// no triggers in them, and writes its positions. The nth frame
+// of the run is at frame + (ff * n). The fade and the self duck
+// are only worked out if the run gets to them, the same as
+// grain_amp().
+//
+// Like all the loops over a run this goes a whole chunk at a
+// time from beg, so it writes up to a chunk past end. The next
+// run writes over those frames.
+inline
+auto make_ramp(const fudge::grain& grain, size_t beg, size_t end, grain_ramp* r) -> void {
+	const auto frame_0 = grain.frame;
+	const auto ff      = grain.ff;
+	const auto size    = grain.size;
+	const auto window  = grain.window;
+	const auto tail    = size - window;
+	const auto beg_0   = grain.beg[0];
+	const auto beg_1   = grain.beg[1];
+	// int, so that the comparisons are the same width as the
+	// floats
+	const auto run_beg  = int(beg);
+	const auto run_size = int(end - beg);
+	const auto frame_n  = frame_0 + (ff * float(run_size - 1));
+	for (int c = 0; c < run_size; c += CHUNK_SIZE) {
+		for (int j = 0; j < CHUNK_SIZE; j++) {
+			const auto n     = c + j;
+			const auto frame = frame_0 + (ff * float(n));
+			r->run.pos[0][run_beg + n] = beg_0 + frame;
+			r->run.pos[1][run_beg + n] = beg_1 + frame;
+		}
+	}
+	// The positions go one way over the run, so the lowest is
+	// at one end of it
+	const auto lowest = std::min(frame_0, frame_n);
+	r->negative[0] |= int(beg_0 + lowest < 0.f);
+	r->negative[1] |= int(beg_1 + lowest < 0.f);
+	r->on_count    = 0;
+	r->fading      = 0;
+	if (!grain.on) {
+		std::fill(r->self_duck.begin() + run_beg, r->self_duck.begin() + run_beg + chunk_ceil(run_size), 1.f);
+		return;
+	}
+	// The grain is on until its frame reaches its size, which
+	// only has to be looked for if it gets there in this run
+	r->on_count = run_size;
+	if (!(frame_n < size)) {
+		auto on_count = 0;
+		for (int c = 0; c < run_size; c += CHUNK_SIZE) {
+			for (int j = 0; j < CHUNK_SIZE; j++) {
+				const auto n     = c + j;
+				const auto frame = frame_0 + (ff * float(n));
+				on_count += int(n < run_size) & int(frame < size);
+			}
+		}
+		r->on_count = on_count;
+	}
+	// If the grain is moving forwards, the frames which are fading
+	// in come first and the frames in the tail come last, so only
+	// the chunks they might be in have to be looked at. The extra
+	// frame either side is for rounding.
+	const auto forwards = ff > 0.f;
+	if (grain.fade_in && std::min(frame_0, frame_n) < window) {
+		const auto on_count  = r->on_count;
+		const auto fade_size = forwards ? std::min(float(run_size), ((window - frame_0) / ff) + 1.f) : float(run_size);
+		const auto fade_end  = std::min(run_size, int(fade_size) + 1);
+		auto fading = 0;
+		for (int c = 0; c < fade_end; c += CHUNK_SIZE) {
+			for (int j = 0; j < CHUNK_SIZE; j++) {
+				const auto n     = c + j;
+				const auto frame = frame_0 + (ff * float(n));
+				r->fade[run_beg + n] = in_out(1.f - ((window - frame) / window));
+				fading += int(n < on_count) & int(frame < window);
+			}
+		}
+		r->fading = fading;
+	}
+	auto duck_beg = run_size;
+	if (std::max(frame_0, frame_n) > tail) {
+		const auto ramp_size = forwards ? std::clamp(((tail - frame_0) / ff) - 1.f, 0.f, float(run_size)) : 0.f;
+		duck_beg = chunk_floor(int(ramp_size));
+		for (int c = duck_beg; c < run_size; c += CHUNK_SIZE) {
+			for (int j = 0; j < CHUNK_SIZE; j++) {
+				const auto n     = c + j;
+				const auto frame = frame_0 + (ff * float(n));
+				r->self_duck[run_beg + n] = select(frame > tail, in_out(1.f - ((frame - tail) / window)), 1.f);
+			}
+		}
+	}
+	std::fill(r->self_duck.begin() + run_beg, r->self_duck.begin() + run_beg + chunk_ceil(duck_beg), 1.f);
+}
+
+// The rest of grain_amp() for the frames [beg, end), leaving the
+// amp of each grain in its run and moving the grains along to
+// end. A grain only fades in at its start, so over a run it
+// fades for some frames and then holds its last frame_amp, and
+// the duck it puts on the other grain does the same. As in
+// process(), grain 0 goes first on each frame, so grain 0 is
+// ducked by grain 1 a frame later than grain 1 is by grain 0.
+inline
+auto apply_ramps(fudge::particle* p, size_t beg, size_t end, vector_ramps* r) -> void {
+	auto& g0 = p->grains[0];
+	auto& g1 = p->grains[1];
+	auto& r0 = r->grains[0];
+	auto& r1 = r->grains[1];
+	const auto run_beg  = int(beg);
+	const auto run_size = int(end - beg);
+	const auto fading_0 = r0.fading;
+	const auto fading_1 = r1.fading;
+	const auto held_0   = fading_0 > 0 ? r0.fade[run_beg + fading_0 - 1] : g0.frame_amp;
+	const auto held_1   = fading_1 > 0 ? r1.fade[run_beg + fading_1 - 1] : g1.frame_amp;
+	const auto ducks_0  = fading_0 > 0;
+	const auto ducks_1  = fading_1 > 0;
+	const auto duck_0   = g0.duck;
+	const auto duck_1   = g1.duck;
+	const auto on_0     = r0.on_count;
+	const auto on_1     = r1.on_count;
+	if (!ducks_0 && !ducks_1) {
+		// Nothing fades in, so only the self ducks change
+		for (int c = 0; c < run_size; c += CHUNK_SIZE) {
+			for (int j = 0; j < CHUNK_SIZE; j++) {
+				const auto n     = c + j;
+				const auto i     = run_beg + n;
+				const auto amp_0 = held_0 * std::min(duck_0, r0.self_duck[i]) * r->amp[i];
+				const auto amp_1 = held_1 * std::min(duck_1, r1.self_duck[i]) * r->amp[i];
+				r0.run.amp[i] = select((n < on_0) & (amp_0 > 0.f), amp_0, 0.f);
+				r1.run.amp[i] = select((n < on_1) & (amp_1 > 0.f), amp_1, 0.f);
+			}
+		}
+	}
+	else {
+		// Indexed from the start of the run. Grain 0's duck on
+		// frame n is at index n.
+		std::array<float, kFloatsPerDSPVector + CHUNK_SIZE> frame_amp_0;
+		std::array<float, kFloatsPerDSPVector + CHUNK_SIZE> frame_amp_1;
+		std::array<float, kFloatsPerDSPVector + CHUNK_SIZE + 1> late_duck_0;
+		for (int c = 0; c < run_size; c += CHUNK_SIZE) {
+			for (int j = 0; j < CHUNK_SIZE; j++) {
+				const auto n       = c + j;
+				const auto i       = run_beg + n;
+				frame_amp_0[n]     = select(n < fading_0, r0.fade[i], held_0);
+				frame_amp_1[n]     = select(n < fading_1, r1.fade[i], held_1);
+				late_duck_0[n + 1] = select(ducks_1, 1.f - frame_amp_1[n], duck_0);
+			}
+		}
+		late_duck_0[0] = duck_0;
+		for (int c = 0; c < run_size; c += CHUNK_SIZE) {
+			for (int j = 0; j < CHUNK_SIZE; j++) {
+				const auto n     = c + j;
+				const auto i     = run_beg + n;
+				const auto amp_0 = frame_amp_0[n] * std::min(late_duck_0[n], r0.self_duck[i]) * r->amp[i];
+				const auto amp_1 = frame_amp_1[n] * std::min(select(ducks_0, 1.f - frame_amp_0[n], duck_1), r1.self_duck[i]) * r->amp[i];
+				r0.run.amp[i] = select((n < on_0) & (amp_0 > 0.f), amp_0, 0.f);
+				r1.run.amp[i] = select((n < on_1) & (amp_1 > 0.f), amp_1, 0.f);
+			}
+		}
+	}
+	g0.frame_amp = held_0;
+	g1.frame_amp = held_1;
+	g0.duck      = ducks_1 ? 1.f - held_1 : duck_0;
+	g1.duck      = ducks_0 ? 1.f - held_0 : duck_1;
+	for (size_t grain_idx = 0; grain_idx < 2; grain_idx++) {
+		auto& grain = p->grains[grain_idx];
+		if (grain.on) {
+			grain.frame += grain.ff * float(r->grains[grain_idx].on_count);
+			grain.on     = grain.frame < grain.size;
+		}
+	}
+}
+
+// Finds the frames of a run which are heard
+inline
+auto find_heard(grain_run* run) -> void {
+	run->beg = 0;
+	run->end = kFloatsPerDSPVector;
+	while (run->beg < kFloatsPerDSPVector && !(run->amp[run->beg] > 0.f)) {
+		run->beg++;
+	}
+	while (run->end > run->beg && !(run->amp[run->end - 1] > 0.f)) {
+		run->end--;
+	}
+}
+
+} // detail
+
+template <typename ReadSampleFn> [[nodiscard]]
+auto process(fudge::particle* p, const fudge::vector_info& v, fudge::frame_info f, ReadSampleFn read_sample_fn) -> stereo_frame {
+	stereo_frame out;
+	detail::update_triggers(p, v, f);
 	for (size_t grain_idx = 0; grain_idx < 2; grain_idx++) {
 		stereo_frame grain_out;
 		auto& grain = p->grains[grain_idx]; 
 		if (!grain.on) {
 			continue; 
 		}
-		if (grain.frame < grain.window) {
-			if (grain.fade_in) {
-				grain.frame_amp = easing::quadratic::in_out(1.f - ((grain.window - grain.frame) / grain.window)); 
-				float other_grain_duck = 1.f - grain.frame_amp; 
-				detail::other_grain(p, grain_idx).duck = other_grain_duck;
-			}
-		} 
-		float self_duck = 1.f; 
-		if (grain.frame > grain.size - grain.window) {
-			self_duck = easing::quadratic::in_out(1.f - ((grain.frame - (grain.size - grain.window)) / grain.window));
-		} 
-		auto final_duck = std::min(grain.duck, self_duck);
-		auto overall_amp = grain.frame_amp * final_duck * v.amp.value[f.idx];
+		auto overall_amp = detail::grain_amp(p, grain_idx, v.amp.value[f.idx]);
 		if (overall_amp > 0.f) {
 			if (v.channel_count.value > 1) {
-				grain_out = detail::read_stereo_frame(*p, v, read_sample_fn, grain); 
+				grain_out = detail::read_stereo_frame(v, read_sample_fn, grain); 
 			}
 			else {
-				grain_out.L = detail::read_mono_frame(*p, read_sample_fn, grain);
+				grain_out.L = detail::read_mono_frame(read_sample_fn, grain);
 				grain_out.R = grain_out.L;
 			} 
 			grain_out.L *= overall_amp;
 			grain_out.R *= overall_amp;
 		} 
-		grain.frame += grain.ff; 
-		if (grain.frame >= grain.size) {
-			grain.on = false;
-		} 
+		detail::advance(&grain);
 		out.L += grain_out.L;
 		out.R += grain_out.R;
 	} 
@@ -316,5 +720,72 @@ auto process(fudge::particle* p, const fudge::vector_info& v, fudge::frame_info
 	return out;
 }
 
+// Renders a whole vector, reading samples in bulk with
+// read_samples_fn(channel, positions, count, out).
+//
+// The vector is split into runs at the frames where grains are
+// triggered. The envelope of each grain is worked out for a
+// whole run at once, and each grain's samples are read in one
+// go. The result is the same as calling process() for each
+// frame, except that the frames of the grains and the trigger
+// timer are worked out from the start of each run instead of
+// by adding ff every frame, so they are rounded differently if
+// ff isn't a whole number.
+template <typename ReadSamplesFn> [[nodiscard]]
+auto process(fudge::particle* p, const fudge::vector_info& v, const fudge::vector_flags& flags, ReadSamplesFn read_samples_fn) -> ml::DSPVectorArray<2> {
+	const auto only_play = detail::only_play(flags);
+	detail::vector_ramps ramps;
+	std::copy(v.amp.value.getConstBuffer(), v.amp.value.getConstBuffer() + kFloatsPerDSPVector, ramps.amp.begin());
+	std::fill(ramps.amp.begin() + kFloatsPerDSPVector, ramps.amp.end(), 0.f);
+	size_t beg = 0;
+	while (beg < kFloatsPerDSPVector) {
+		detail::update_triggers(p, v, {flags.value[beg], int(beg)});
+		// Nothing else can be triggered until the timer reaches
+		// the next grain or the flags change
+		const auto& grain     = p->grains[p->flip_flop.value];
+		const auto ff         = grain.ff;
+		const auto trigger_at = std::floor(grain.size / 2);
+		const auto timer      = p->trigger_timer;
+		const auto end        = only_play && ff > 0.f
+			? detail::find_due(beg, p->trig_primed, timer, ff, trigger_at)
+			: detail::find_trigger(flags, beg, p->trig_primed, timer, ff, trigger_at);
+		detail::make_ramp(p->grains[0], beg, end, &ramps.grains[0]);
+		detail::make_ramp(p->grains[1], beg, end, &ramps.grains[1]);
+		detail::apply_ramps(p, beg, end, &ramps);
+		p->trigger_timer = timer + (ff * float(end - beg));
+		beg = end;
+	}
+	ml::DSPVectorArray<2> out;
+	const auto out_L = out.row(0).getBuffer();
+	const auto out_R = out.row(1).getBuffer();
+	for (auto& ramp : ramps.grains) {
+		auto& run = ramp.run;
+		detail::find_heard(&run);
+		if (run.beg >= run.end) {
+			continue;
+		}
+		// Mixed over whole chunks. The amp is zero outside the
+		// run.
+		const auto chunk_beg = detail::chunk_floor(int(run.beg));
+		const auto chunk_end = detail::chunk_ceil(int(run.end));
+		std::array<float, kFloatsPerDSPVector> L;
+		std::array<float, kFloatsPerDSPVector> R;
+		const auto read = [read_samples_fn, &ramp, &run, chunk_beg, chunk_end](int channel, float* out) {
+			std::fill(out + chunk_beg, out + run.beg, 0.f);
+			std::fill(out + run.end, out + chunk_end, 0.f);
+			detail::read_run(read_samples_fn, channel, run, ramp.negative[size_t(channel)] != 0, out);
+		};
+		const auto& R_in = detail::read_channels(v, read, L.data(), R.data()) ? R : L;
+		for (auto c = chunk_beg; c < chunk_end; c += detail::CHUNK_SIZE) {
+			for (int j = 0; j < detail::CHUNK_SIZE; j++) {
+				const auto i = c + j;
+				out_L[i] += L[i] * run.amp[i];
+				out_R[i] += R_in[i] * run.amp[i];
+			}
+		}
+	}
+	return out;
+}
+
 } // fudge
 } // snd
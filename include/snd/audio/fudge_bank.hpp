@@ -0,0 +1,146 @@
+#pragma once
+
+#include "fudge.hpp"
+#include "voice_renderer.hpp"
+#include <cstdint>
+#include <limits>
+
+namespace snd {
+namespace fudge {
+
+// A fixed number of fudge particles ("voices"), with voice
+// allocation and stealing. Each voice is rendered with the
+// vector overload of fudge::process() and sounds exactly the
+// same as a fudge::particle would.
+template <size_t N>
+struct bank {
+	std::array<fudge::particle, N> voices;
+	// 0 if the voice isn't in use, otherwise it goes up with
+	// every allocation so the oldest voice can be found
+	std::array<uint64_t, N> started = {};
+	uint64_t next_start = 1;
+};
+
+// Input for one vector. Voices which aren't in use are ignored.
+// A voice which is in use but has no info is paused, i.e. it is
+// silent and its grains don't move.
+template <size_t N>
+struct bank_block {
+	std::array<const fudge::vector_info*, N> info = {};
+	std::array<fudge::vector_flags, N> flags;
+};
+
+struct allocation {
+	size_t voice;
+	// True if every voice was in use so one was taken from
+	// whoever had it
+	bool stolen;
+};
+
+template <size_t N> [[nodiscard]]
+auto is_in_use(const fudge::bank<N>& b, size_t voice) -> bool {
+	return b.started[voice] != 0;
+}
+
+// Both grains have finished, so taking the voice away from
+// whoever has it won't be heard
+template <size_t N> [[nodiscard]]
+auto is_silent(const fudge::bank<N>& b, size_t voice) -> bool {
+	const auto& grains = b.voices[voice].grains;
+	return !grains[0].on && !grains[1].on;
+}
+
+// Returns a voice which is ready to be triggered. If every voice
+// is in use then the oldest silent one is stolen, or failing
+// that the oldest one.
+template <size_t N> [[nodiscard]]
+auto allocate(fudge::bank<N>* b) -> allocation {
+	auto voice  = N;
+	auto stolen = false;
+	for (size_t v = 0; v < N; v++) {
+		if (!is_in_use(*b, v)) {
+			voice = v;
+			break;
+		}
+	}
+	if (voice == N) {
+		stolen = true;
+		auto oldest = std::numeric_limits<uint64_t>::max();
+		auto oldest_silent = oldest;
+		auto silent_voice = N;
+		for (size_t v = 0; v < N; v++) {
+			if (b->started[v] < oldest) {
+				oldest = b->started[v];
+				voice  = v;
+			}
+			if (is_silent(*b, v) && b->started[v] < oldest_silent) {
+				oldest_silent = b->started[v];
+				silent_voice  = v;
+			}
+		}
+		if (silent_voice != N) {
+			voice = silent_voice;
+		}
+	}
+	b->voices[voice] = fudge::particle{};
+	b->started[voice] = b->next_start++;
+	return {voice, stolen};
+}
+
+template <size_t N>
+auto release(fudge::bank<N>* b, size_t voice) -> void {
+	b->started[voice] = 0;
+	b->voices[voice] = fudge::particle{};
+}
+
+// Renders every voice in use and returns the mix. Samples are
+// read in bulk with
+//
+//   read_samples_fn(voice, channel, positions, count, out)
+template <size_t N, typename ReadSamplesFn> [[nodiscard]]
+auto render(fudge::bank<N>* b, const fudge::bank_block<N>& block, ReadSamplesFn read_samples_fn) -> ml::DSPVectorArray<2> {
+	ml::DSPVectorArray<2> out;
+	const auto out_L = out.row(0).getBuffer();
+	const auto out_R = out.row(1).getBuffer();
+	for (size_t v = 0; v < N; v++) {
+		if (!is_in_use(*b, v) || !block.info[v]) {
+			continue;
+		}
+		const auto read = [v, &read_samples_fn](int channel, const float* positions, size_t count, float* out) {
+			read_samples_fn(v, channel, positions, count, out);
+		};
+		const auto voice = fudge::process(&b->voices[v], *block.info[v], block.flags[v], read);
+		const auto voice_L = voice.constRow(0).getConstBuffer();
+		const auto voice_R = voice.constRow(1).getConstBuffer();
+		for (size_t i = 0; i < kFloatsPerDSPVector; i++) {
+			out_L[i] += voice_L[i];
+			out_R[i] += voice_R[i];
+		}
+	}
+	return out;
+}
+
+// The same as render(), but with the voices split across the
+// threads of a th::realtime_pool by a voices::renderer, which
+// should have room for N voices. read_samples_fn will be called
+// from several threads at once.
+//
+// The voices are summed a chunk at a time, so the mix can be
+// rounded differently to render() if the renderer puts more
+// than one voice in a chunk, but it is the same whatever the
+// number of threads.
+template <size_t N, typename ReadSamplesFn> [[nodiscard]]
+auto render(fudge::bank<N>* b, const fudge::bank_block<N>& block, audio::voices::renderer<2>* r, th::realtime_pool* pool, ReadSamplesFn read_samples_fn) -> ml::DSPVectorArray<2> {
+	return audio::voices::render(r, pool, N, [b, &block, &read_samples_fn](size_t v) {
+		if (!is_in_use(*b, v) || !block.info[v]) {
+			return ml::DSPVectorArray<2>{};
+		}
+		const auto read = [v, &read_samples_fn](int channel, const float* positions, size_t count, float* out) {
+			read_samples_fn(v, channel, positions, count, out);
+		};
+		return fudge::process(&b->voices[v], *block.info[v], block.flags[v], read);
+	});
+}
+
+} // fudge
+} // snd
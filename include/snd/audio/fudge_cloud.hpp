@@ -0,0 +1,263 @@
+#pragma once
+
+#include "fudge.hpp"
+#include <algorithm>
+
+namespace snd {
+namespace fudge {
+
+// Like fudge::particle but with up to MAX_GRAINS grains sounding
+// at once instead of two. A new grain is started every hop,
+// which is 1/density of the grain size, so density grains are
+// heard at full level at any time.
+//
+// There is no ducking. Every grain fades in over its first hop
+// and out over one more hop after its size, with the same curve
+// as the particle, read from a table. The curve and its reverse
+// add up to one, so each fade out is exactly filled by the next
+// fade in and the sum of the grains is density times the input.
+// It is scaled down by the density. Nothing is allocated.
+//
+// Up to density + 1 grains sound during a fade so the density is
+// clamped to [1, MAX_GRAINS - 1].
+struct cloud_grain {
+	bool fade_in  = true;
+	bool on       = false;
+	float ff      = 1.0f;
+	float frame   = 0.0f;
+	// Including the fade out
+	float size    = 1536.0f;
+	float hop     = 512.0f;
+	float inv_hop = 1.0f / 512.0f;
+	std::array<float, 2> beg = {};
+};
+
+template <size_t MAX_GRAINS>
+struct cloud {
+	static_assert(MAX_GRAINS >= 2);
+	size_t density      = 2;
+	bool trig_primed    = false;
+	float trigger_timer = 0.0f;
+	// The grain which was started most recently
+	size_t last = 0;
+	std::array<fudge::cloud_grain, MAX_GRAINS> grains;
+};
+
+namespace detail {
+
+static constexpr auto CLOUD_FADE_TABLE_SIZE = size_t(1024);
+
+using cloud_fade_table = std::array<float, CLOUD_FADE_TABLE_SIZE + 1>;
+
+[[nodiscard]] constexpr
+auto make_cloud_fade_table() -> cloud_fade_table {
+	cloud_fade_table out = {};
+	for (size_t i = 0; i <= CLOUD_FADE_TABLE_SIZE; i++) {
+		out[i] = easing::quadratic::in_out(float(i) / float(CLOUD_FADE_TABLE_SIZE));
+	}
+	return out;
+}
+
+static constexpr auto CLOUD_FADE_TABLE = make_cloud_fade_table();
+
+// The fade curve at t, which is clamped to [0, 1]
+[[nodiscard]] inline
+auto cloud_fade(float t) -> float {
+	const auto x     = std::clamp(t, 0.0f, 1.0f) * float(CLOUD_FADE_TABLE_SIZE);
+	const auto index = std::min(size_t(x), CLOUD_FADE_TABLE_SIZE - 1);
+	return lerp(CLOUD_FADE_TABLE[index], CLOUD_FADE_TABLE[index + 1], x - float(index));
+}
+
+template <size_t MAX_GRAINS> [[nodiscard]]
+auto density(const fudge::cloud<MAX_GRAINS>& c) -> size_t {
+	return std::clamp(c.density, size_t(1), MAX_GRAINS - 1);
+}
+
+template <size_t MAX_GRAINS> [[nodiscard]]
+auto gain(const fudge::cloud<MAX_GRAINS>& c) -> float {
+	return 1.0f / float(density(c));
+}
+
+template <size_t MAX_GRAINS> [[nodiscard]]
+auto trigger_at(const fudge::cloud<MAX_GRAINS>& c) -> float {
+	return c.grains[c.last].hop;
+}
+
+// The first free grain after the last one, or if they are all
+// on, the one nearest its end
+template <size_t MAX_GRAINS> [[nodiscard]]
+auto next_grain(const fudge::cloud<MAX_GRAINS>& c) -> size_t {
+	auto out           = c.last;
+	auto most_progress = -1.0f;
+	for (size_t i = 1; i <= MAX_GRAINS; i++) {
+		const auto grain_idx = (c.last + i) % MAX_GRAINS;
+		const auto& grain    = c.grains[grain_idx];
+		if (!grain.on) {
+			return grain_idx;
+		}
+		const auto progress = grain.frame / grain.size;
+		if (progress > most_progress) {
+			out           = grain_idx;
+			most_progress = progress;
+		}
+	}
+	return out;
+}
+
+template <size_t MAX_GRAINS>
+auto trigger_next_grain(fudge::cloud<MAX_GRAINS>* c, const fudge::vector_info& v, fudge::frame_info f, bool adjust) -> void {
+	const auto grain_idx = next_grain(*c);
+	const auto fade_in   = v.sample_position.value[f.idx] > frame_pos{0};
+	const auto beg       = get_positions(v, f, adjust, c->grains[c->last]);
+	const auto ratio     = v.harmonic_ratio.value[f.idx];
+	const auto ff        = v.ff.value[f.idx];
+	const auto size      = std::max(MIN_GRAIN_SIZE, v.size.value[f.idx] * ff);
+	const auto density   = float(detail::density(*c));
+	const auto hop       = std::max(1.0f, std::floor(size / density));
+	auto& grain = c->grains[grain_idx];
+	grain.on      = true;
+	grain.fade_in = fade_in;
+	grain.beg[0]  = beg.L;
+	grain.beg[1]  = beg.R;
+	grain.ff      = v.frame_increment.value * ff * ratio;
+	grain.size    = hop * (density + 1);
+	grain.hop     = hop;
+	grain.inv_hop = 1.0f / hop;
+	grain.frame   = 0.0f;
+	c->last = grain_idx;
+}
+
+template <size_t MAX_GRAINS>
+auto reset(fudge::cloud<MAX_GRAINS>* c, const fudge::vector_info& v, fudge::frame_info f) -> void {
+	for (auto& grain : c->grains) {
+		grain.on = false;
+	}
+	c->trig_primed   = false;
+	c->trigger_timer = 0.0f;
+	trigger_next_grain(c, v, f, false);
+}
+
+template <size_t MAX_GRAINS>
+auto update_triggers(fudge::cloud<MAX_GRAINS>* c, const fudge::vector_info& v, fudge::frame_info f) -> void {
+	const auto play  = is_flag_set(f.flags, f.flags.play);
+	const auto reset = is_flag_set(f.flags, f.flags.reset);
+	if (c->trig_primed && play) {
+		detail::reset(c, v, f);
+	}
+	else {
+		if (reset) {
+			if (!play) { c->trig_primed = true; }
+			else       { detail::reset(c, v, f); }
+		}
+		else if (c->trigger_timer >= trigger_at(*c)) {
+			if (play) {
+				c->trigger_timer = 0.f;
+				trigger_next_grain(c, v, f, true);
+			}
+		}
+	}
+}
+
+template <size_t MAX_GRAINS> [[nodiscard]]
+auto is_trigger_frame(const fudge::cloud<MAX_GRAINS>& c, fudge::frame_flags flags, float trigger_at) -> bool {
+	const auto play  = is_flag_set(flags, flags.play);
+	const auto reset = is_flag_set(flags, flags.reset);
+	if (reset) {
+		return true;
+	}
+	if (!play) {
+		return false;
+	}
+	return c.trig_primed || c.trigger_timer >= trigger_at;
+}
+
+[[nodiscard]] inline
+auto grain_amp(const fudge::cloud_grain& grain, float amp) -> float {
+	const auto fade_in  = grain.fade_in ? cloud_fade(grain.frame * grain.inv_hop) : 1.0f;
+	const auto fade_out = cloud_fade((grain.size - grain.frame) * grain.inv_hop);
+	return std::min(fade_in, fade_out) * amp;
+}
+
+// Renders frames [beg, end), which have no triggers in them,
+// one grain at a time
+template <size_t MAX_GRAINS, typename ReadSamplesFn>
+auto render_frames(fudge::cloud<MAX_GRAINS>* c, const fudge::vector_info& v, ReadSamplesFn read_samples_fn, size_t beg, size_t end, float* out_L, float* out_R) -> void {
+	const auto gain = detail::gain(*c);
+	for (auto& grain : c->grains) {
+		if (!grain.on) {
+			continue;
+		}
+		grain_run run;
+		for (auto i = beg; i < end && grain.on; i++) {
+			const auto amp = grain_amp(grain, v.amp.value[int(i)] * gain);
+			run.pos[0][i] = grain.beg[0] + grain.frame;
+			run.pos[1][i] = grain.beg[1] + grain.frame;
+			if (amp > 0.f) {
+				run.amp[i] = amp;
+				run.beg    = std::min(run.beg, i);
+				run.end    = i + 1;
+			}
+			advance(&grain);
+		}
+		render_run(v, read_samples_fn, run, out_L, out_R);
+	}
+}
+
+} // detail
+
+template <size_t MAX_GRAINS, typename ReadSampleFn> [[nodiscard]]
+auto process(fudge::cloud<MAX_GRAINS>* c, const fudge::vector_info& v, fudge::frame_info f, ReadSampleFn read_sample_fn) -> stereo_frame {
+	stereo_frame out;
+	detail::update_triggers(c, v, f);
+	const auto amp = v.amp.value[f.idx] * detail::gain(*c);
+	for (auto& grain : c->grains) {
+		stereo_frame grain_out;
+		if (!grain.on) {
+			continue;
+		}
+		const auto overall_amp = detail::grain_amp(grain, amp);
+		if (overall_amp > 0.f) {
+			if (v.channel_count.value > 1) {
+				grain_out = detail::read_stereo_frame(v, read_sample_fn, grain);
+			}
+			else {
+				grain_out.L = detail::read_mono_frame(read_sample_fn, grain);
+				grain_out.R = grain_out.L;
+			}
+			grain_out.L *= overall_amp;
+			grain_out.R *= overall_amp;
+		}
+		detail::advance(&grain);
+		out.L += grain_out.L;
+		out.R += grain_out.R;
+	}
+	c->trigger_timer += c->grains[c->last].ff;
+	return out;
+}
+
+// Renders a whole vector, reading samples in bulk with
+// read_samples_fn(channel, positions, count, out). The result
+// is the same as calling process() for each frame.
+template <size_t MAX_GRAINS, typename ReadSamplesFn> [[nodiscard]]
+auto process(fudge::cloud<MAX_GRAINS>* c, const fudge::vector_info& v, const fudge::vector_flags& flags, ReadSamplesFn read_samples_fn) -> ml::DSPVectorArray<2> {
+	ml::DSPVectorArray<2> out;
+	const auto out_L = out.row(0).getBuffer();
+	const auto out_R = out.row(1).getBuffer();
+	size_t beg = 0;
+	while (beg < kFloatsPerDSPVector) {
+		detail::update_triggers(c, v, {flags.value[beg], int(beg)});
+		const auto& grain     = c->grains[c->last];
+		const auto trigger_at = detail::trigger_at(*c);
+		auto end = beg;
+		do {
+			c->trigger_timer += grain.ff;
+			end++;
+		} while (end < kFloatsPerDSPVector && !detail::is_trigger_frame(*c, flags.value[end], trigger_at));
+		detail::render_frames(c, v, read_samples_fn, beg, end, out_L, out_R);
+		beg = end;
+	}
+	return out;
+}
+
+} // fudge
+} // snd
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <array>
+
+#include "delay.hpp"
+
+namespace snd {
+namespace audio {
+
+// Several read heads on a single delay memory. The input is
+// written once per block no matter how many taps are read,
+// so memory and write bandwidth don't scale with TAPS.
+template <size_t ROWS, size_t TAPS, typename Interp = delay_interp::four_point>
+class MultiTapDelay
+{
+
+public:
+
+	using Taps = std::array<ml::DSPVectorArray<ROWS>, TAPS>;
+
+	MultiTapDelay(int SR, size_t size)
+		: SR_(SR)
+		, ring_(size)
+	{
+	}
+
+	// Returns the sum of all taps, each scaled by its gain
+	ml::DSPVectorArray<ROWS> operator()(
+		const ml::DSPVectorArray<ROWS>& dry,
+		const Taps& time,
+		const Taps& gain)
+	{
+		ring_.write(dry);
+
+		ml::DSPVectorArray<ROWS> out { 0.0f };
+
+		for (size_t tap = 0; tap < TAPS; tap++)
+		{
+			out += read_tap(tap, time[tap]) * gain[tap];
+		}
+
+		ring_.advance();
+
+		return out;
+	}
+
+	// Returns each tap separately
+	Taps operator()(
+		const ml::DSPVectorArray<ROWS>& dry,
+		const Taps& time)
+	{
+		ring_.write(dry);
+
+		Taps out;
+
+		for (size_t tap = 0; tap < TAPS; tap++)
+		{
+			out[tap] = read_tap(tap, time[tap]);
+		}
+
+		ring_.advance();
+
+		return out;
+	}
+
+	void clear()
+	{
+		ring_.clear();
+		interp_ = {};
+	}
+
+private:
+
+	ml::DSPVectorArray<ROWS> read_tap(size_t tap, const ml::DSPVectorArray<ROWS>& time)
+	{
+		return ring_.read(ring_.template get_delay_time<Interp>(time), &interp_[tap]);
+	}
+
+	int SR_ { 44100 };
+	detail::DelayRing<ROWS> ring_;
+	std::array<std::array<Interp, ROWS>, TAPS> interp_;
+};
+
+} // audio
+} // snd
\ No newline at end of file
@@ -0,0 +1,149 @@
+#pragma once
+
+#include "oscillators.hpp"
+#include <array>
+#include <bit>
+#include <cstdint>
+#pragma warning(push, 0)
+#include <DSP/MLDSPOps.h>
+#pragma warning(pop)
+
+namespace snd {
+namespace osc {
+
+// N multiwave oscillators stored as structures of arrays, so
+// that lane i of every array belongs to oscillator i. process()
+// renders a whole vector of every oscillator and mixes them
+// down, e.g. the partials of an additive patch or the voices
+// of a supersaw.
+//
+// The frequency, width, wave and gain of each oscillator are
+// read once per vector. Gains are ramped across the vector from
+// the last value. Apart from that each oscillator sounds exactly
+// the same as scalar::process_multiwave_osc() would with the same
+// phasor, including the polyBLEP.
+//
+// Oscillators can be synced to an outside phasor (e.g. the
+// sync_out of a scalar::Phasor for each frame) with a hardness
+// for each oscillator. They don't produce a sync output.
+template <size_t N>
+struct bank {
+	// Oscillators [0, count) are rendered
+	size_t count = N;
+	std::array<uint32_t, N> phase = {};
+	// Worked out from freq at the start of each vector
+	std::array<uint32_t, N> inc = {};
+	// Cycles per frame
+	std::array<float, N> freq = {};
+	std::array<float, N> width;
+	std::array<float, N> wave;
+	std::array<float, N> gain = {};
+	std::array<float, N> sync_hardness;
+	// The gain at the end of the last vector
+	std::array<float, N> last_gain = {};
+	bank() {
+		width.fill(0.5f);
+		wave.fill(scalar::MULTIWAVE_SINE);
+		sync_hardness.fill(-1.0f);
+	}
+};
+
+namespace detail {
+
+// The phases of one oscillator for each frame of the vector,
+// the same as calling scalar::process() for each frame
+template <size_t N>
+auto update_phases(osc::bank<N>* b, size_t i, const float* sync_in, uint32_t* out) -> void {
+	const auto inc = b->inc[i];
+	if (!sync_in || !(b->sync_hardness[i] > 0.0f)) {
+		const auto phase = b->phase[i];
+		for (size_t f = 0; f < kFloatsPerDSPVector; f++) {
+			out[f] = phase + (inc * uint32_t(f + 1));
+		}
+		b->phase[i] = out[kFloatsPerDSPVector - 1];
+		return;
+	}
+	scalar::Phasor p;
+	p.phase = b->phase[i];
+	const auto hardness = b->sync_hardness[i];
+	for (size_t f = 0; f < kFloatsPerDSPVector; f++) {
+		scalar::detail::update_phase(&p, inc, {sync_in[f], hardness});
+		out[f] = p.phase;
+	}
+	b->phase[i] = p.phase;
+}
+
+// Adds one oscillator's vector to out. Between wave values a
+// and b only the two shapes either side are worked out, the same
+// as scalar::phase_to_multiwave().
+template <typename ShapeA, typename ShapeB>
+auto mix_shapes(const uint32_t* phases, float x, float gain_0, float gain_1, ShapeA shape_a, ShapeB shape_b, float* out) -> void {
+	const auto gain_inc = (gain_1 - gain_0) * (1.0f / float(kFloatsPerDSPVector));
+	for (size_t f = 0; f < kFloatsPerDSPVector; f++) {
+		const auto phase = to_float(phases[f]) * scalar::PHASOR_CYCLES_PER_STEP;
+		const auto gain  = gain_0 + (gain_inc * float(int32_t(f + 1)));
+		out[f] += lerp(shape_a(phase), shape_b(phase), x) * gain;
+	}
+}
+
+template <size_t N>
+auto mix(const osc::bank<N>& b, size_t i, const uint32_t* phases, float* out) -> void {
+	using namespace scalar;
+	const auto freq   = b.freq[i];
+	const auto width  = b.width[i];
+	const auto wave   = b.wave[i];
+	const auto gain_0 = b.last_gain[i];
+	const auto gain_1 = b.gain[i];
+	const auto sine     = [](float phase) { return phase_to_sine(phase); };
+	const auto triangle = [](float phase) { return phase_to_triangle(phase); };
+	const auto pulse    = [freq, width](float phase) { return phase_to_pulse(phase, freq, width); };
+	const auto saw      = [freq](float phase) { return phase_to_saw(phase, freq); };
+	if (wave < MULTIWAVE_TRIANGLE) {
+		mix_shapes(phases, inverse_lerp(MULTIWAVE_SINE, MULTIWAVE_TRIANGLE, wave), gain_0, gain_1, sine, triangle, out);
+		return;
+	}
+	if (wave < MULTIWAVE_PULSE) {
+		mix_shapes(phases, inverse_lerp(MULTIWAVE_TRIANGLE, MULTIWAVE_PULSE, wave), gain_0, gain_1, triangle, pulse, out);
+		return;
+	}
+	mix_shapes(phases, inverse_lerp(MULTIWAVE_PULSE, MULTIWAVE_SAW, wave), gain_0, gain_1, pulse, saw, out);
+}
+
+template <size_t N>
+auto process(osc::bank<N>* b, const float* sync_in) -> ml::DSPVector {
+	ml::DSPVector out;
+	const auto count = std::min(b->count, N);
+	for (size_t i = 0; i < count; i++) {
+		b->inc[i] = static_cast<uint32_t>(b->freq[i] * scalar::PHASOR_STEPS_PER_CYCLE);
+	}
+	for (size_t i = 0; i < count; i++) {
+		std::array<uint32_t, kFloatsPerDSPVector> phases;
+		update_phases(b, i, sync_in, phases.data());
+		if (b->last_gain[i] != 0.0f || b->gain[i] != 0.0f) {
+			mix(*b, i, phases.data(), out.getBuffer());
+		}
+		b->last_gain[i] = b->gain[i];
+	}
+	return out;
+}
+
+} // detail
+
+template <size_t N> [[nodiscard]]
+auto process(osc::bank<N>* b) -> ml::DSPVector {
+	return detail::process(b, nullptr);
+}
+
+// sync_in is the sync input for each frame, as in scalar::Sync
+template <size_t N> [[nodiscard]]
+auto process(osc::bank<N>* b, const ml::DSPVector& sync_in) -> ml::DSPVector {
+	return detail::process(b, sync_in.getConstBuffer());
+}
+
+template <size_t N>
+auto reset(osc::bank<N>* b) -> void {
+	b->phase.fill(0);
+}
+
+} // osc
+} // snd
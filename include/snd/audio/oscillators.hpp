@@ -2,6 +2,9 @@
 
 #include "../const_math.hpp"
 #include "../misc.hpp"
+#include <algorithm>
+#include <array>
+#include <cstdint>
 
 namespace snd {
 namespace osc {
@@ -211,6 +214,246 @@ inline auto reset(PulseOsc* osc) -> void { reset(&osc->phasor); }
 inline auto reset(SawOsc* osc) -> void { reset(&osc->phasor); }
 inline auto reset(MultiWaveOsc* osc) -> void { reset(&osc->phasor); }
 
+} // scalar
+
+namespace detail {
+
+// Exactly float(x). There's no vector instruction for that
+// before AVX-512, but both halves convert exactly and the sum
+// is then rounded once.
+[[nodiscard]] inline
+auto to_float(uint32_t x) -> float {
+	return (float(int32_t(x >> 16)) * 65536.0f) + float(int32_t(x & 0xFFFFu));
+}
+
+// The same as scalar::polyblep() without the branches. Only one
+// of the two divisions can be needed so the numerator is picked
+// first.
+[[nodiscard]] inline
+auto polyblep(float t, float dt) -> float {
+	const auto is_lo = t < dt;
+	const auto x     = select(is_lo, t, t - 1.0f) / dt;
+	const auto c_lo  = x + x - x * x - 1.0f;
+	const auto c_hi  = x * x + x + x + 1.0f;
+	return select(is_lo, c_lo, select(t > 1.0f - dt, c_hi, 0.0f));
+}
+
+// The same as scalar::phase_to_sine() without the branch
+[[nodiscard]] inline
+auto phase_to_sine(float phase) -> float {
+	constexpr auto sqrt2       = static_cast<float>(::const_math::sqrt(2.0f));
+	constexpr auto range       = sqrt2 - sqrt2 * sqrt2 * sqrt2 / 6.0f;
+	constexpr auto scale       = 1.0f / range;
+	constexpr auto domain      = sqrt2 * 4.0f;
+	constexpr auto flip_offset = sqrt2 * 2.0f;
+	constexpr auto one_sixth   = 1.0f / 6.0f;
+	const auto omega           = phase * (domain) + (-sqrt2);
+	const auto triangle        = select(omega > sqrt2, flip_offset - omega, omega);
+	return scale * triangle * (1.0f - triangle * triangle * one_sixth);
+}
+
+// The same as scalar::phase_to_triangle() without the branch
+[[nodiscard]] inline
+auto phase_to_triangle(float phase) -> float {
+	const auto omega    = 2.0f * phase;
+	const auto triangle = select(phase > 0.5f, 2.0f - omega, omega);
+	return (2.0f * triangle) - 1.0f;
+}
+
+// The same as scalar::phase_to_pulse() without the branches.
+// The phase is in [0, 1) and the width in [0, 1] so the modf
+// can be done with a truncation.
+[[nodiscard]] inline
+auto phase_to_pulse(float phase, float freq, float width) -> float {
+	auto pulse = select(phase > width, -1.0f, 1.0f);
+	pulse += polyblep(phase, freq);
+	const auto down = phase - width + 1.0f;
+	pulse -= polyblep(down - float(int32_t(down)), freq);
+	return pulse;
+}
+
+[[nodiscard]] inline
+auto phase_to_saw(float phase, float freq) -> float {
+	const auto saw = phase * 2.0f - 1.0f;
+	return saw - polyblep(phase, freq);
+}
+
+// The same as scalar::phase_to_multiwave() without the branches
+[[nodiscard]] inline
+auto phase_to_multiwave(float phase, float freq, float width, float wave) -> float {
+	using namespace scalar;
+	const auto sine     = phase_to_sine(phase);
+	const auto triangle = phase_to_triangle(phase);
+	const auto pulse    = phase_to_pulse(phase, freq, width);
+	const auto saw      = phase_to_saw(phase, freq);
+	const auto is_a     = wave < MULTIWAVE_TRIANGLE;
+	const auto is_b     = wave < MULTIWAVE_PULSE;
+	const auto a        = select(is_a, sine, select(is_b, triangle, pulse));
+	const auto b        = select(is_a, triangle, select(is_b, pulse, saw));
+	const auto beg      = select(is_a, MULTIWAVE_SINE, select(is_b, MULTIWAVE_TRIANGLE, MULTIWAVE_PULSE));
+	const auto end      = select(is_a, MULTIWAVE_TRIANGLE, select(is_b, MULTIWAVE_PULSE, MULTIWAVE_SAW));
+	return lerp(a, b, inverse_lerp(beg, end, wave));
+}
+
+} // detail
+
+namespace scalar {
+
+// Sync for each frame of a vector, the same as Sync. No sync if
+// either is null.
+struct VectorSync {
+	const ml::DSPVector* in = nullptr;
+	const ml::DSPVector* hardness = nullptr;
+};
+
+static constexpr inline auto NO_VECTOR_SYNC = VectorSync{};
+
+namespace detail {
+
+[[nodiscard]] inline
+auto is_synced(VectorSync sync) -> bool {
+	if (!sync.in || !sync.hardness) {
+		return false;
+	}
+	const auto in       = sync.in->getConstBuffer();
+	const auto hardness = sync.hardness->getConstBuffer();
+	auto out = false;
+	for (size_t i = 0; i < kFloatsPerDSPVector; i++) {
+		out |= (in[i] > 0.0f) & (hardness[i] > 0.0f);
+	}
+	return out;
+}
+
+// Without sync the phase is a running sum of the increments
+inline
+auto accumulate(Phasor* p, const uint32_t* inc, uint32_t* phases) -> void {
+	auto phase = p->phase;
+	for (size_t i = 0; i < kFloatsPerDSPVector; i++) {
+		phase    += inc[i];
+		phases[i] = phase;
+	}
+	p->phase = phase;
+}
+
+inline
+auto accumulate(Phasor* p, const uint32_t* inc, VectorSync sync, uint32_t* phases) -> void {
+	const auto in       = sync.in->getConstBuffer();
+	const auto hardness = sync.hardness->getConstBuffer();
+	for (size_t i = 0; i < kFloatsPerDSPVector; i++) {
+		update_phase(p, inc[i], {in[i], hardness[i]});
+		phases[i] = p->phase;
+	}
+}
+
+// The same as update_sync_value() for each frame
+inline
+auto get_sync_out(uint32_t prev_phase, const uint32_t* phases, const uint32_t* inc, float* out) -> void {
+	std::array<uint32_t, kFloatsPerDSPVector> prev;
+	prev[0] = prev_phase;
+	std::copy(phases, phases + kFloatsPerDSPVector - 1, prev.begin() + 1);
+	for (size_t i = 0; i < kFloatsPerDSPVector; i++) {
+		const auto crossed = prev[i] < PHASOR_MIDPOINT_INT && phases[i] >= PHASOR_MIDPOINT_INT;
+		const auto value   = osc::detail::to_float(phases[i] - PHASOR_MIDPOINT_INT) / osc::detail::to_float(inc[i]);
+		out[i] = snd::select(crossed, value, -1.0f);
+	}
+}
+
+} // detail
+
+// Phases for a whole vector, the same as calling process() for
+// each frame. Vectors with no sync in them take a fast path.
+// p->sync_out is left with the value for the last frame.
+[[nodiscard]] inline
+auto process(Phasor* p, const ml::DSPVector& cycles_per_frame, VectorSync sync = NO_VECTOR_SYNC, ml::DSPVector* sync_out = nullptr) -> ml::DSPVector {
+	ml::DSPVector out;
+	std::array<uint32_t, kFloatsPerDSPVector> inc;
+	std::array<uint32_t, kFloatsPerDSPVector> phases;
+	const auto freq = cycles_per_frame.getConstBuffer();
+	for (size_t i = 0; i < kFloatsPerDSPVector; i++) {
+		inc[i] = static_cast<uint32_t>(freq[i] * PHASOR_STEPS_PER_CYCLE);
+	}
+	const auto prev_phase = p->phase;
+	if (detail::is_synced(sync)) {
+		detail::accumulate(p, inc.data(), sync, phases.data());
+	}
+	else {
+		detail::accumulate(p, inc.data(), phases.data());
+	}
+	if (sync_out) {
+		detail::get_sync_out(prev_phase, phases.data(), inc.data(), sync_out->getBuffer());
+		p->sync_out = (*sync_out)[kFloatsPerDSPVector - 1];
+	}
+	else {
+		const auto last = kFloatsPerDSPVector - 1;
+		detail::update_sync_value(p, phases[last - 1], inc[last]);
+	}
+	const auto out_ptr = out.getBuffer();
+	for (size_t i = 0; i < kFloatsPerDSPVector; i++) {
+		out_ptr[i] = osc::detail::to_float(phases[i]) * PHASOR_CYCLES_PER_STEP;
+	}
+	return out;
+}
+
+namespace detail {
+
+template <typename Osc, typename ShapeFn> [[nodiscard]]
+auto process_vector(Osc* osc, const ml::DSPVector& freq, VectorSync sync, ml::DSPVector* sync_out, ShapeFn shape) -> ml::DSPVector {
+	const auto phase = process(&osc->phasor, freq, sync, sync_out);
+	ml::DSPVector out;
+	const auto phase_ptr = phase.getConstBuffer();
+	const auto out_ptr   = out.getBuffer();
+	for (size_t i = 0; i < kFloatsPerDSPVector; i++) {
+		out_ptr[i] = shape(phase_ptr[i], i);
+	}
+	osc->value = out_ptr[kFloatsPerDSPVector - 1];
+	return out;
+}
+
+} // detail
+
+// Whole vectors. Each one gives the same result as calling the
+// per-frame version for each frame.
+[[nodiscard]] inline
+auto process(SineOsc* osc, const ml::DSPVector& freq, VectorSync sync = NO_VECTOR_SYNC, ml::DSPVector* sync_out = nullptr) -> ml::DSPVector {
+	return detail::process_vector(osc, freq, sync, sync_out, [](float phase, size_t) {
+		return osc::detail::phase_to_sine(phase);
+	});
+}
+
+[[nodiscard]] inline
+auto process(TriangleOsc* osc, const ml::DSPVector& freq, VectorSync sync = NO_VECTOR_SYNC, ml::DSPVector* sync_out = nullptr) -> ml::DSPVector {
+	return detail::process_vector(osc, freq, sync, sync_out, [](float phase, size_t) {
+		return osc::detail::phase_to_triangle(phase);
+	});
+}
+
+[[nodiscard]] inline
+auto process(PulseOsc* osc, const ml::DSPVector& freq, const ml::DSPVector& width, VectorSync sync = NO_VECTOR_SYNC, ml::DSPVector* sync_out = nullptr) -> ml::DSPVector {
+	const auto freq_ptr  = freq.getConstBuffer();
+	const auto width_ptr = width.getConstBuffer();
+	return detail::process_vector(osc, freq, sync, sync_out, [freq_ptr, width_ptr](float phase, size_t i) {
+		return osc::detail::phase_to_pulse(phase, freq_ptr[i], width_ptr[i]);
+	});
+}
+
+[[nodiscard]] inline
+auto process(SawOsc* osc, const ml::DSPVector& freq, VectorSync sync = NO_VECTOR_SYNC, ml::DSPVector* sync_out = nullptr) -> ml::DSPVector {
+	const auto freq_ptr = freq.getConstBuffer();
+	return detail::process_vector(osc, freq, sync, sync_out, [freq_ptr](float phase, size_t i) {
+		return osc::detail::phase_to_saw(phase, freq_ptr[i]);
+	});
+}
+
+[[nodiscard]] inline
+auto process(MultiWaveOsc* osc, const ml::DSPVector& freq, const ml::DSPVector& width, const ml::DSPVector& wave, VectorSync sync = NO_VECTOR_SYNC, ml::DSPVector* sync_out = nullptr) -> ml::DSPVector {
+	const auto freq_ptr  = freq.getConstBuffer();
+	const auto width_ptr = width.getConstBuffer();
+	const auto wave_ptr  = wave.getConstBuffer();
+	return detail::process_vector(osc, freq, sync, sync_out, [freq_ptr, width_ptr, wave_ptr](float phase, size_t i) {
+		return osc::detail::phase_to_multiwave(phase, freq_ptr[i], width_ptr[i], wave_ptr[i]);
+	});
+}
+
 } // scalar
 } // osc
-} // snd
\ No newline at end of file
+} // snd
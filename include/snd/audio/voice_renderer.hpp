@@ -0,0 +1,79 @@
+#pragma once
+
+#include "../realtime_pool.hpp"
+#include <algorithm>
+#include <vector>
+#pragma warning(push, 0)
+#include <DSP/MLDSPOps.h>
+#pragma warning(pop)
+
+namespace snd {
+namespace audio {
+namespace voices {
+
+// Renders independent voices on a th::realtime_pool and mixes
+// them down. render_fn(voice) renders one vector of one voice
+// and returns it, for example:
+//
+//   fudge::process(&particles[voice], info[voice], flags, read)
+//
+// or glottis::process() followed by tract::process() for a
+// vocal voice, or a loop over wavebender::process() for the
+// 64 frames of a wavebender voice. It will be called on
+// different threads, but never twice at the same time for the
+// same voice.
+//
+// The voices are split into fixed chunks of voices_per_chunk.
+// Each chunk is summed into its own buffer in voice order and
+// the chunks are then summed in order on the calling thread, so
+// the result is always exactly the same whatever the number of
+// threads and however the chunks end up spread across them.
+//
+// All the buffers are allocated by make_renderer.
+template <size_t ROWS>
+struct renderer {
+	size_t max_voices       = 0;
+	size_t voices_per_chunk = 1;
+	std::vector<ml::DSPVectorArray<ROWS>> chunks;
+};
+
+namespace detail {
+
+[[nodiscard]] inline
+auto chunk_count(size_t voice_count, size_t voices_per_chunk) -> size_t {
+	return (voice_count + voices_per_chunk - 1) / voices_per_chunk;
+}
+
+} // detail
+
+template <size_t ROWS> [[nodiscard]]
+auto make_renderer(size_t max_voices, size_t voices_per_chunk = 1) -> voices::renderer<ROWS> {
+	voices::renderer<ROWS> out;
+	out.max_voices       = max_voices;
+	out.voices_per_chunk = std::max(size_t(1), voices_per_chunk);
+	out.chunks.resize(detail::chunk_count(max_voices, out.voices_per_chunk));
+	return out;
+}
+
+// Renders voices [0, voice_count). voice_count is clamped to
+// max_voices.
+template <size_t ROWS, typename RenderFn> [[nodiscard]]
+auto render(voices::renderer<ROWS>* r, th::realtime_pool* pool, size_t voice_count, RenderFn&& render_fn) -> ml::DSPVectorArray<ROWS> {
+	voice_count = std::min(voice_count, r->max_voices);
+	pool->parallel_for(voice_count, r->voices_per_chunk, [r, &render_fn](size_t beg, size_t end) {
+		auto& sum = r->chunks[beg / r->voices_per_chunk];
+		sum = render_fn(beg);
+		for (auto voice = beg + 1; voice < end; voice++) {
+			sum += render_fn(voice);
+		}
+	});
+	ml::DSPVectorArray<ROWS> out;
+	for (size_t i = 0; i < detail::chunk_count(voice_count, r->voices_per_chunk); i++) {
+		out += r->chunks[i];
+	}
+	return out;
+}
+
+} // voices
+} // audio
+} // snd
@@ -1,6 +1,10 @@
 #pragma once
 
+#include <algorithm>
 #include <array>
+#include <bit>
+#include <cstdint>
+#include <new>
 #include <vector>
 #include <snd/ease.hpp>
 #include <snd/misc.hpp>
@@ -15,6 +19,29 @@ namespace wavebender {
 
 static constexpr auto INIT = 4;
 
+namespace detail {
+
+static constexpr auto CACHE_LINE_BYTES = size_t(64);
+
+// Allocates on a cache line boundary
+template <typename T>
+struct cache_line_allocator {
+	using value_type = T;
+	cache_line_allocator() = default;
+	template <typename U> cache_line_allocator(const cache_line_allocator<U>&) {}
+	[[nodiscard]]
+	auto allocate(size_t n) -> T* {
+		return static_cast<T*>(::operator new(n * sizeof(T), std::align_val_t{CACHE_LINE_BYTES}));
+	}
+	auto deallocate(T* p, size_t) -> void {
+		::operator delete(p, std::align_val_t{CACHE_LINE_BYTES});
+	}
+	template <typename U>
+	auto operator==(const cache_line_allocator<U>&) const -> bool { return true; }
+};
+
+} // detail
+
 enum class CrossfadeMode {
 	Static,
 	Dynamic,
@@ -33,7 +60,15 @@ struct FrameReadParams {
 };
 
 struct Channel {
-	std::array<std::vector<float>, 4> buffers;
+	static constexpr auto NO_SLOT = size_t(-1);
+	// Four buffers of buffer_size frames each. The memory belongs
+	// either to the channel itself (init(channel, SR)) or to a
+	// Pool (init(channel, pool, cycle_length)).
+	std::array<float*, 4> buffers = {};
+	size_t buffer_size = 0;
+	size_t capacity = 0;
+	size_t pool_slot = NO_SLOT;
+	std::vector<float, detail::cache_line_allocator<float>> memory;
 	struct Span {
 		float* buffer = nullptr;
 		size_t size = 0;
@@ -79,8 +114,8 @@ auto do_write(Channel* c, const FrameWriteParams& params, float filtered_value,
 		c->init++;
 	}
 	c->write.span.buffer[c->write.span.size++] = value; 
-	if (c->write.span.size >= c->buffers[0].size()) {
-		c->write.span.size = c->buffers[0].size();
+	if (c->write.span.size >= c->buffer_size) {
+		c->write.span.size = c->buffer_size;
 		std::swap(c->write.span, c->stage.span);
 		c->write.up = false;
 		return;
@@ -263,29 +298,412 @@ auto generate_frame(Channel* channel, float input, float smoothed_input, Crossfa
 	return process(channel, write_params, read_params, input, smoothed_input);
 }
 
+namespace detail {
+
+// Polynomial approximations used by the vector path. There are
+// no branches, so loops over them can be vectorized.
+//
+// fast_log2 is within 2e-7 of log2 for normal x > 0, and
+// fast_exp2 is within a relative 1e-7 of exp2 for x in
+// [-100, 100].
+[[nodiscard]] inline
+auto fast_log2(float x) -> float {
+	const auto bits     = std::bit_cast<uint32_t>(x);
+	const auto exponent = float(int32_t(bits >> 23) - 127);
+	const auto m        = std::bit_cast<float>((bits & 0x007FFFFFu) | 0x3F800000u) - 1.0f;
+	auto p = -0.008665699511766434f;
+	p = (p * m) + 0.04943336918950081f;
+	p = (p * m) - 0.13314692676067352f;
+	p = (p * m) + 0.2380419820547104f;
+	p = (p * m) - 0.34542933106422424f;
+	p = (p * m) + 0.47817644476890564f;
+	p = (p * m) - 0.7210957407951355f;
+	p = (p * m) + 1.442685842514038f;
+	p = (p * m) + 5.642244005343855e-08f;
+	return exponent + p;
+}
+
+[[nodiscard]] inline
+auto fast_exp2(float x) -> float {
+	x = select(x < -100.0f, -100.0f, x);
+	x = select(x > 100.0f, 100.0f, x);
+	const auto truncated = int32_t(x);
+	const auto whole     = truncated - int32_t(float(truncated) > x);
+	const auto f         = x - float(whole);
+	auto p = 0.00021865784947294742f;
+	p = (p * f) + 0.0012391331838443875f;
+	p = (p * f) + 0.009684186428785324f;
+	p = (p * f) + 0.055480629205703735f;
+	p = (p * f) + 0.24023045599460602f;
+	p = (p * f) + 0.6931469440460205f;
+	p = (p * f) + 1.0f;
+	return std::bit_cast<float>(std::bit_cast<uint32_t>(p) + (uint32_t(whole) << 23));
+}
+
+// x must be >= 0. Zero stays zero instead of turning into a
+// denormal, which would be slow to do anything else with.
+[[nodiscard]] inline
+auto fast_pow(float x, float y) -> float {
+	const auto out = fast_exp2(y * fast_log2(select(x > 0.0f, x, 1.0f)));
+	return select(x > 0.0f, out, 0.0f);
+}
+
+// Same as window() without the branches. The rise is exactly 1
+// from r onwards and the fall is exactly 1 up to 1 - r, so the
+// product is the same as picking one of them.
+[[nodiscard]] inline
+auto window_no_branch(float x, float r = 0.5f) -> float {
+	const auto top  = 1.0f - r;
+	const auto rise = snd::easing::parametric::in_out(select(x < r, x, r) * (1.0f / r));
+	const auto fall = 1.0f - snd::easing::parametric::in_out((select(x > top, x, top) - top) * (1.0f / r));
+	return rise * fall;
+}
+
+// Same as apply_tilt() but with pow(2, tilt) worked out once by
+// the caller and the other pow approximated
+[[nodiscard]] inline
+auto apply_tilt_fast(float frame, float exponent, float spike, float size) -> float {
+	const auto pos      = frame / size;
+	const auto tilted   = fast_pow(pos, exponent);
+	const auto smoothed = snd::lerp(pos, tilted, window_no_branch(pos));
+	return snd::lerp(smoothed, tilted, spike) * size;
+}
+
+// Same as read() for pos >= 0, without the floor, the ceil and
+// (usually) the divisions
+[[nodiscard]] inline
+auto read_fast(const float* buffer, size_t size, float pos) -> float {
+	auto index_0 = size_t(pos);
+	const auto x = pos - float(index_0);
+	if (index_0 >= size) {
+		index_0 %= size;
+	}
+	const auto index_1 = index_0 + 1 == size ? 0 : index_0 + 1;
+	return snd::lerp(buffer[index_0], buffer[index_1], x);
+}
+
+// What do_read() does on each frame of a vector, worked out
+// before anything is read
+struct read_plan {
+	enum flags : uint8_t {
+		wet     = 1 << 0,
+		xfade   = 1 << 1,
+		fade_in = 1 << 2,
+	};
+	struct span {
+		std::array<const float*, kFloatsPerDSPVector> buffer;
+		std::array<size_t, kFloatsPerDSPVector> size;
+		std::array<float, kFloatsPerDSPVector> float_size;
+		std::array<float, kFloatsPerDSPVector> frame;
+		// The frame after the tilt
+		std::array<float, kFloatsPerDSPVector> pos;
+	};
+	span source;
+	span target;
+	std::array<float, kFloatsPerDSPVector> xfade_amp;
+	std::array<float, kFloatsPerDSPVector> fade_in_amp;
+	std::array<uint8_t, kFloatsPerDSPVector> flags;
+};
+
+// Loops over runs go a chunk of frames at a time, so that each
+// inner loop has a fixed length, which GCC needs to vectorize it
+// at -O2
+static constexpr auto CHUNK_SIZE = 16;
+
+// Tilts the frames [beg, end) of a span into its positions, and
+// the frames either side up to whole chunks. With no tilt the
+// window makes no difference and the result is exactly the same
+// as apply_tilt().
+inline
+auto apply_tilt_fast(read_plan::span* span, float exponent, float spike, int beg, int end) -> void {
+	const auto chunk_beg = beg - (beg % CHUNK_SIZE);
+	if (exponent == 1.0f) {
+		for (auto c = chunk_beg; c < end; c += CHUNK_SIZE) {
+			for (int j = 0; j < CHUNK_SIZE; j++) {
+				const auto i = c + j;
+				span->pos[i] = (span->frame[i] / span->float_size[i]) * span->float_size[i];
+			}
+		}
+		return;
+	}
+	for (auto c = chunk_beg; c < end; c += CHUNK_SIZE) {
+		for (int j = 0; j < CHUNK_SIZE; j++) {
+			const auto i = c + j;
+			span->pos[i] = apply_tilt_fast(span->frame[i], exponent, spike, span->float_size[i]);
+		}
+	}
+}
+
+inline
+auto plan_span(read_plan::span* plan, const Channel::Span& span, float frame, size_t i) -> void {
+	plan->buffer[i]     = span.buffer;
+	plan->size[i]       = span.size;
+	plan->float_size[i] = float(span.size);
+	plan->frame[i]      = frame;
+}
+
+// The same steps as do_xfade()
+inline
+auto plan_xfade(Channel* c, const FrameReadParams& params, read_plan* plan, size_t i) -> void {
+	const auto x = snd::easing::quadratic::in_out(float(c->xfade.index) / (c->xfade.length - 1));
+	plan_span(&plan->source, c->source.span, c->source.frame, i);
+	plan_span(&plan->target, c->target.span, c->target.frame, i);
+	plan->xfade_amp[i] = x;
+	plan->flags[i]    |= read_plan::xfade;
+	const auto source_inc = snd::lerp(c->xfade.source_speed_0, c->xfade.source_speed_1, x) * params.ff;
+	const auto target_inc = snd::lerp(c->xfade.target_speed_0, c->xfade.target_speed_1, x) * params.ff; 
+	c->source.frame += source_inc;
+	c->target.frame += target_inc; 
+	const auto source_end = (c->source.span.size - 1);
+	const auto target_end = (c->target.span.size - 1); 
+	if (c->source.frame > source_end) c->source.frame -= source_end;
+	if (c->target.frame > target_end) c->target.frame -= target_end; 
+	c->xfade.index++; 
+	if (c->xfade.index >= c->xfade.length) {
+		c->xfade.active = false;
+	} 
+}
+
+// The same steps as do_wet()
+inline
+auto plan_wet(Channel* c, const FrameReadParams& params, read_plan* plan, size_t i) -> void {
+	if (c->xfade.active) {
+		plan_xfade(c, params, plan, i);
+		return;
+	}
+	plan_span(&plan->target, c->target.span, c->target.frame, i);
+	c->target.frame += params.ff; 
+	const auto end = (c->target.span.size - 1); 
+	if (c->target.frame > end) {
+		c->target.frame -= end; 
+		if (c->stage.span.size > 0) {
+			prepare_xfade(c, params);
+			start_xfade(c, params);
+		}
+	} 
+}
+
+// The same steps as do_read()
+inline
+auto plan_read(Channel* c, const FrameReadParams& params, read_plan* plan, size_t i) -> void {
+	plan->flags[i] = 0;
+	if (c->init == INIT) {
+		start_fade_in(c, params);
+		c->init++;
+	}
+	if (c->init < INIT) {
+		return;
+	}
+	plan->flags[i] = read_plan::wet;
+	plan_wet(c, params, plan, i);
+	if (c->fade_in.active) {
+		plan->fade_in_amp[i] = snd::easing::quadratic::in_out(float(c->fade_in.index++) / c->fade_in.length);
+		plan->flags[i]      |= read_plan::fade_in;
+		if (c->fade_in.index >= c->fade_in.length) {
+			c->fade_in.active = false;
+		}
+	} 
+}
+
+// Reads frames [beg, end) of the plan
+inline
+auto render_plan(read_plan* plan, const FrameReadParams& params, float exponent, const float* in, float* out, size_t beg, size_t end) -> void {
+	uint8_t any_flags = 0;
+	for (auto i = beg; i < end; i++) {
+		any_flags |= plan->flags[i];
+	}
+	if (any_flags & read_plan::xfade) {
+		apply_tilt_fast(&plan->source, exponent, params.spike, int(beg), int(end));
+	}
+	apply_tilt_fast(&plan->target, exponent, params.spike, int(beg), int(end));
+	for (auto i = beg; i < end; i++) {
+		const auto flags = plan->flags[i];
+		if (!(flags & read_plan::wet)) {
+			out[i] = in[i];
+			continue;
+		}
+		auto value = read_fast(plan->target.buffer[i], plan->target.size[i], plan->target.pos[i]);
+		if (flags & read_plan::xfade) {
+			const auto source_value = read_fast(plan->source.buffer[i], plan->source.size[i], plan->source.pos[i]);
+			value = snd::lerp(source_value, value, plan->xfade_amp[i]);
+		}
+		if (flags & read_plan::fade_in) {
+			value = snd::lerp(in[i], value, plan->fade_in_amp[i]);
+		}
+		out[i] = value;
+	}
+}
+
+} // detail
+
+// Processes a whole vector with the same parameters for every
+// frame. Apart from a very small difference in the tilt (the
+// pow is approximated) the output is the same as calling
+// process() for each frame.
+//
+// All the bookkeeping is done first, frame by frame, and the
+// tilt and the reads are then done for a run of frames at a
+// time. A run ends whenever a new cycle starts being written,
+// since the buffer it is written to may have been read from
+// earlier in the vector.
+[[nodiscard]] inline
+auto process(Channel* c, const FrameWriteParams& write_params, const FrameReadParams& read_params, const ml::DSPVector& in, const ml::DSPVector& filtered_in) -> ml::DSPVector {
+	ml::DSPVector out;
+	detail::read_plan plan;
+	// Keeps the tilt calculations harmless for frames which don't
+	// read anything, including the ones past the end of a run
+	for (auto span : {&plan.source, &plan.target}) {
+		span->size.fill(1);
+		span->float_size.fill(1.0f);
+		span->frame.fill(0.0f);
+	}
+	const auto exponent = std::pow(2.0f, read_params.tilt);
+	const auto in_ptr   = in.getConstBuffer();
+	const auto out_ptr  = out.getBuffer();
+	size_t beg = 0;
+	for (size_t i = 0; i < kFloatsPerDSPVector; i++) {
+		const auto write_buffer = c->write.span.buffer;
+		do_write(c, write_params, filtered_in[int(i)], in[int(i)]);
+		if (c->write.span.buffer != write_buffer) {
+			detail::render_plan(&plan, read_params, exponent, in_ptr, out_ptr, beg, i);
+			beg = i;
+		}
+		detail::plan_read(c, read_params, &plan, i);
+	}
+	detail::render_plan(&plan, read_params, exponent, in_ptr, out_ptr, beg, kFloatsPerDSPVector);
+	return out;
+}
+
+[[nodiscard]] inline
+auto generate_vector(Channel* channel, const ml::DSPVector& input, const ml::DSPVector& smoothed_input, CrossfadeMode mode, int bubble, float spike, float tilt, float pitch, float xfade_size) -> ml::DSPVector {
+	FrameWriteParams write_params; 
+	write_params.bubble = bubble;
+	FrameReadParams read_params; 
+	read_params.crossfade_size = xfade_size;
+	read_params.crossfade_mode = mode;
+	read_params.tilt = tilt;
+	read_params.spike = spike;
+	read_params.ff = pitch;
+	return process(channel, write_params, read_params, input, smoothed_input);
+}
+
 inline
 auto reset(Channel* c) -> void {
 	c->init = 0;
 	c->fade_in.active = false;
 	c->xfade.active = false;
-	c->write.span.buffer = c->buffers[0].data();
+	c->write.span.buffer = c->buffers[0];
 	c->write.span.size = 0;
 	c->write.counter = 0;
 	c->write.filter.clear();
 	c->write.up = false;
-	c->stage.span.buffer = c->buffers[1].data();
+	c->stage.span.buffer = c->buffers[1];
 	c->stage.span.size = 0;
-	c->source.span.buffer = c->buffers[2].data();
+	c->source.span.buffer = c->buffers[2];
 	c->source.span.size = 0;
-	c->target.span.buffer = c->buffers[3].data();
+	c->target.span.buffer = c->buffers[3];
 	c->target.span.size = 0;
 }
 
+namespace detail {
+
+// Buffer sizes are rounded up to this many frames. The memory
+// starts on a cache line, so each buffer has its own cache
+// lines.
+static constexpr auto BUFFER_ALIGNMENT = CACHE_LINE_BYTES / sizeof(float);
+
+[[nodiscard]] inline
+auto aligned_size(size_t frames) -> size_t {
+	return ((frames + BUFFER_ALIGNMENT - 1) / BUFFER_ALIGNMENT) * BUFFER_ALIGNMENT;
+}
+
+inline
+auto point_buffers(Channel* c, float* memory, size_t capacity, size_t cycle_length) -> void {
+	for (size_t i = 0; i < 4; i++) {
+		c->buffers[i] = memory + (i * capacity);
+	}
+	c->capacity    = capacity;
+	c->buffer_size = std::clamp(cycle_length, size_t(1), capacity);
+	reset(c);
+}
+
+} // detail
+
+// Buffer memory shared by up to channel_count channels, each
+// with cycles of up to max_cycle_length frames. Everything is
+// allocated by make_pool(), so channels can be given buffers,
+// have them taken away again and change their cycle length on
+// the audio thread. A Pool isn't thread safe.
+struct Pool {
+	size_t channel_count = 0;
+	size_t capacity = 0;
+	std::vector<float, detail::cache_line_allocator<float>> memory;
+	std::vector<size_t> free_slots;
+};
+
+[[nodiscard]] inline
+auto make_pool(size_t channel_count, size_t max_cycle_length) -> Pool {
+	Pool out;
+	out.channel_count = channel_count;
+	out.capacity = detail::aligned_size(std::max(max_cycle_length, size_t(1)));
+	out.memory.resize(channel_count * 4 * out.capacity);
+	out.free_slots.reserve(channel_count);
+	for (size_t i = 0; i < channel_count; i++) {
+		out.free_slots.push_back(channel_count - 1 - i);
+	}
+	return out;
+}
+
+// Gives the channel its own buffers for cycles of up to SR
+// frames. This allocates.
 inline
 auto init(Channel* channel, int SR) -> void {
-	for (int i = 0; i < 4; i++) {
-		channel->buffers[i].resize(SR);
+	const auto cycle_length = size_t(std::max(SR, 1));
+	const auto capacity     = detail::aligned_size(cycle_length);
+	channel->memory.resize(4 * capacity);
+	channel->pool_slot = Channel::NO_SLOT;
+	detail::point_buffers(channel, channel->memory.data(), capacity, cycle_length);
+}
+
+// Gives the channel buffers from the pool, with cycles of up to
+// cycle_length frames (which is clamped to the pool's maximum).
+// Doesn't allocate. Returns false if every slot in the pool is
+// taken. The channel must not already have buffers from a pool.
+inline
+auto init(Channel* channel, Pool* pool, size_t cycle_length) -> bool {
+	if (pool->free_slots.empty()) {
+		return false;
+	}
+	const auto slot = pool->free_slots.back();
+	pool->free_slots.pop_back();
+	channel->pool_slot = slot;
+	detail::point_buffers(channel, pool->memory.data() + (slot * 4 * pool->capacity), pool->capacity, cycle_length);
+	return true;
+}
+
+// Gives the channel's buffers back to the pool
+inline
+auto release(Channel* channel, Pool* pool) -> void {
+	if (channel->pool_slot == Channel::NO_SLOT) {
+		return;
+	}
+	pool->free_slots.push_back(channel->pool_slot);
+	channel->pool_slot = Channel::NO_SLOT;
+	channel->buffers = {};
+	channel->buffer_size = 0;
+	channel->capacity = 0;
+}
+
+// For a sample rate change. The cycle length is clamped to the
+// capacity the buffers were made with so nothing is allocated,
+// and the channel is reset.
+inline
+auto set_cycle_length(Channel* channel, size_t cycle_length) -> void {
+	if (channel->capacity == 0) {
+		return;
 	}
+	channel->buffer_size = std::clamp(cycle_length, size_t(1), channel->capacity);
+	reset(channel);
 }
 
 } // wavebender
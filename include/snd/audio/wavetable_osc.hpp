@@ -0,0 +1,156 @@
+#pragma once
+
+#include "../fft.hpp"
+#include "oscillators.hpp"
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+#include <vector>
+#pragma warning(push, 0)
+#include <DSP/MLDSPOps.h>
+#pragma warning(pop)
+
+namespace snd {
+namespace osc {
+
+// One cycle of a waveform, band-limited once per octave.
+//
+// Level l keeps harmonics up to size / 4 >> l, which is the
+// most that can be played without aliasing at frequencies up to
+// 2^l / (size / 2) cycles per frame. Keeping to a quarter of
+// the table size leaves every level at least twice oversampled,
+// so linear interpolation is good enough. The last level is a
+// single sine.
+//
+// A wavetable is built off the audio thread by make_wavetable()
+// and never changes after that, so any number of voices (on
+// any number of threads) can read from the same one.
+struct wavetable {
+	size_t size = 0;
+	size_t level_count = 0;
+	// Each level is size frames followed by a copy of the first
+	// frame, so reads never have to wrap
+	std::vector<float> data;
+};
+
+static constexpr auto DEFAULT_WAVETABLE_SIZE = size_t(2048);
+
+namespace detail {
+
+[[nodiscard]] inline
+auto level_stride(const osc::wavetable& table) -> size_t {
+	return table.size + 1;
+}
+
+// cycle is resampled (with linear interpolation) to size frames
+inline
+auto resample_cycle(const float* cycle, size_t frames, size_t size, float* out) -> void {
+	if (frames == size) {
+		std::copy(cycle, cycle + size, out);
+		return;
+	}
+	for (size_t i = 0; i < size; i++) {
+		const auto pos   = double(i) * double(frames) / double(size);
+		const auto index = size_t(pos);
+		const auto x     = float(pos - double(index));
+		out[i] = lerp(cycle[index], cycle[(index + 1) % frames], x);
+	}
+}
+
+// ceil(log2(x)) for x > 1, otherwise 0, without any branches.
+// Rounding the mantissa up carries into the exponent unless x
+// is already a power of two.
+[[nodiscard]] inline
+auto ceil_log2(float x) -> int32_t {
+	const auto bits = std::bit_cast<uint32_t>(x) + 0x007FFFFFu;
+	const auto out  = int32_t(bits >> 23) - 127;
+	return out * int32_t(x > 1.0f);
+}
+
+// The level to read for a frequency in cycles per frame
+[[nodiscard]] inline
+auto get_level(const osc::wavetable& table, float freq) -> int32_t {
+	const auto level = ceil_log2(std::abs(freq) * float(table.size / 2));
+	return std::min(level, int32_t(table.level_count) - 1);
+}
+
+// Reads a frame from the table. The phase is in [0, 1].
+[[nodiscard]] inline
+auto read(const osc::wavetable& table, float phase, float freq) -> float {
+	const auto pos   = phase * float(table.size);
+	const auto index = int32_t(pos);
+	const auto x     = pos - float(index);
+	const auto level = get_level(table, freq);
+	// 32 bit offsets so that the reads can be vector gathers
+	const auto frame = (level * int32_t(level_stride(table))) + (index & int32_t(table.size - 1));
+	return lerp(table.data[frame], table.data[frame + 1], x);
+}
+
+} // detail
+
+// Builds the tables for one cycle of a waveform. The cycle can
+// be any length. size is the length of each table and must be
+// a power of two, at least 8. This allocates.
+[[nodiscard]] inline
+auto make_wavetable(const float* cycle, size_t frames, size_t size = DEFAULT_WAVETABLE_SIZE) -> osc::wavetable {
+	assert(frames > 0);
+	assert(fft::is_pow2(size) && size >= 8);
+	osc::wavetable out;
+	out.size = size;
+	for (auto harmonics = size / 4; harmonics > 0; harmonics /= 2) {
+		out.level_count++;
+	}
+	out.data.resize(out.level_count * detail::level_stride(out));
+	const auto plan = fft::make_real_plan(size);
+	std::vector<float> frames_in(size);
+	std::vector<fft::complex> bins(size / 2 + 1);
+	std::vector<fft::complex> level_bins(size / 2 + 1);
+	detail::resample_cycle(cycle, frames, size, frames_in.data());
+	fft::real_forward(plan, frames_in.data(), bins.data());
+	for (size_t level = 0; level < out.level_count; level++) {
+		const auto harmonics = (size / 4) >> level;
+		std::fill(level_bins.begin(), level_bins.end(), fft::complex{});
+		std::copy(bins.begin(), bins.begin() + harmonics + 1, level_bins.begin());
+		const auto p = out.data.data() + (level * detail::level_stride(out));
+		fft::real_inverse(plan, level_bins.data(), p);
+		p[size] = p[0];
+	}
+	return out;
+}
+
+namespace scalar {
+
+// Plays a wavetable, which can be shared with any number of
+// other oscillators. The phasor and sync work the same as for
+// the other oscillators.
+struct WavetableOsc : Oscillator {
+	const osc::wavetable* table = nullptr;
+};
+
+[[nodiscard]] inline
+auto process_wavetable_osc(Phasor* p, const osc::wavetable& table, float freq, Sync sync) -> float {
+	return osc::detail::read(table, process(p, freq, sync), freq);
+}
+
+inline
+auto process(WavetableOsc* osc, float freq, Sync sync) -> float {
+	return osc->value = process_wavetable_osc(&osc->phasor, *osc->table, freq, sync);
+}
+
+// A whole vector, the same as calling the per-frame version for
+// each frame. The phases are worked out first and the table is
+// then read for all of them at once.
+[[nodiscard]] inline
+auto process(WavetableOsc* osc, const ml::DSPVector& freq, VectorSync sync = NO_VECTOR_SYNC, ml::DSPVector* sync_out = nullptr) -> ml::DSPVector {
+	const auto& table   = *osc->table;
+	const auto freq_ptr = freq.getConstBuffer();
+	return detail::process_vector(osc, freq, sync, sync_out, [&table, freq_ptr](float phase, size_t i) {
+		return osc::detail::read(table, phase, freq_ptr[i]);
+	});
+}
+
+inline auto reset(WavetableOsc* osc) -> void { reset(&osc->phasor); }
+
+} // scalar
+} // osc
+} // snd
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <array>
+#include <snd/buffers/harold_buffer.hpp>
+#include <snd/samples/sample_reader.hpp>
+
+namespace snd {
+namespace sample_reader {
+
+namespace detail {
+
+// Enough for a 64 frame vector played back a couple of octaves
+// up. Calls which need more than this are split.
+static constexpr auto HAROLD_SCRATCH_SIZE = int64_t(512);
+
+// Copies frames [beg, beg + count) into out, one sub buffer at
+// a time. Frames which aren't in an allocated sub buffer are
+// zero.
+template <size_t SUB_BUFFER_SIZE, size_t ALLOC_SIZE, class Allocator>
+auto copy_frames(const HaroldBuffer<SUB_BUFFER_SIZE, ALLOC_SIZE, Allocator>& buffer, typename HaroldBuffer<SUB_BUFFER_SIZE, ALLOC_SIZE, Allocator>::row_t row, int64_t beg, int64_t count, float* out) -> void {
+	const auto end = beg + count;
+	if (beg < 0) {
+		const auto zeros = std::min(count, -beg);
+		std::fill(out, out + zeros, 0.0f);
+		out += zeros;
+		beg += zeros;
+	}
+	while (beg < end) {
+		const auto sub_end = std::min(end, ((beg / int64_t(SUB_BUFFER_SIZE)) + 1) * int64_t(SUB_BUFFER_SIZE));
+		const auto frames  = sub_end - beg;
+		const auto copy    = [out, frames](const float* p) { std::copy(p, p + frames, out); };
+		if (!buffer.audio.read_sub_buffer(row, uint64_t(beg), uint64_t(frames), copy)) {
+			std::fill(out, out + frames, 0.0f);
+		}
+		out += frames;
+		beg  = sub_end;
+	}
+}
+
+template <quality Q, size_t SUB_BUFFER_SIZE, size_t ALLOC_SIZE, class Allocator>
+auto read_harold(const HaroldBuffer<SUB_BUFFER_SIZE, ALLOC_SIZE, Allocator>& buffer, typename HaroldBuffer<SUB_BUFFER_SIZE, ALLOC_SIZE, Allocator>::row_t row, const float* positions, size_t count, float* out) -> void {
+	const auto range = get_range(positions, count);
+	const auto beg   = floor_index(range.min) - taps<Q>::BEFORE;
+	const auto end   = floor_index(range.max) + taps<Q>::AFTER + 1;
+	// Usually every tap is in the same sub buffer, which can
+	// then be read in place
+	const auto sub_buffer = beg / int64_t(SUB_BUFFER_SIZE);
+	if (beg >= 0 && sub_buffer == (end - 1) / int64_t(SUB_BUFFER_SIZE)) {
+		const auto sub_end = (sub_buffer + 1) * int64_t(SUB_BUFFER_SIZE);
+		const auto reader  = [=](const float* p) {
+			read_inside<Q>(p, beg, positions, count, out);
+			prefetch_ahead<Q>(p, beg, sub_end, positions, count);
+		};
+		if (!buffer.audio.read_sub_buffer(row, uint64_t(beg), uint64_t(end - beg), reader)) {
+			std::fill(out, out + count, 0.0f);
+		}
+		return;
+	}
+	if (end - beg <= HAROLD_SCRATCH_SIZE) {
+		std::array<float, HAROLD_SCRATCH_SIZE> scratch;
+		copy_frames(buffer, row, beg, end - beg, scratch.data());
+		read_inside<Q>(scratch.data(), beg, positions, count, out);
+		return;
+	}
+	const auto half = count / 2;
+	read_harold<Q>(buffer, row, positions, half, out);
+	read_harold<Q>(buffer, row, positions + half, count - half, out + half);
+}
+
+} // detail
+
+// Reads from a HaroldBuffer on the audio thread. Frames which
+// haven't been allocated yet read as zero, the same as
+// HaroldBuffer::AudioAccess::read(). Taps which fall in two
+// different sub buffers are copied out into a scratch buffer
+// first.
+template <quality Q, size_t SUB_BUFFER_SIZE, size_t ALLOC_SIZE, class Allocator>
+auto read(const HaroldBuffer<SUB_BUFFER_SIZE, ALLOC_SIZE, Allocator>& buffer, typename HaroldBuffer<SUB_BUFFER_SIZE, ALLOC_SIZE, Allocator>::row_t row, const float* positions, size_t count, float* out) -> void {
+	if (count == 0) {
+		return;
+	}
+	detail::read_harold<Q>(buffer, row, positions, count, out);
+}
+
+} // sample_reader
+} // snd
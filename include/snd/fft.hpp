@@ -0,0 +1,178 @@
+#pragma once
+
+#include <cassert>
+#include <cmath>
+#include <complex>
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+namespace snd::fft {
+
+// Iterative radix-2 FFT. Plans hold the bit reversal table
+// and twiddle factors and can be shared between threads.
+// Nothing here allocates except make_plan/make_real_plan.
+
+using complex = std::complex<float>;
+
+struct plan {
+	size_t size = 0;
+	std::vector<size_t> bitrev;
+	std::vector<fft::complex> twiddles;
+};
+
+struct real_plan {
+	size_t size = 0;
+	fft::plan half;
+	std::vector<fft::complex> twiddles;
+};
+
+[[nodiscard]] inline
+auto is_pow2(size_t x) -> bool {
+	return x > 0 && (x & (x - 1)) == 0;
+}
+
+[[nodiscard]] inline
+auto next_pow2(size_t x) -> size_t {
+	size_t out = 1;
+	while (out < x) {
+		out <<= 1;
+	}
+	return out;
+}
+
+namespace detail {
+
+// exp(-2*pi*i*k/n) for k in [0, count)
+[[nodiscard]] inline
+auto make_twiddles(size_t n, size_t count) -> std::vector<fft::complex> {
+	constexpr auto pi = 3.14159265358979323846;
+	std::vector<fft::complex> out(count);
+	for (size_t k = 0; k < count; k++) {
+		const auto angle = -2.0 * pi * double(k) / double(n);
+		out[k] = {float(std::cos(angle)), float(std::sin(angle))};
+	}
+	return out;
+}
+
+} // detail
+
+[[nodiscard]] inline
+auto make_plan(size_t size) -> fft::plan {
+	assert(is_pow2(size));
+	fft::plan out;
+	out.size = size;
+	out.bitrev.resize(size);
+	size_t bits = 0;
+	while ((size_t(1) << bits) < size) {
+		bits++;
+	}
+	for (size_t i = 0; i < size; i++) {
+		size_t r = 0;
+		for (size_t b = 0; b < bits; b++) {
+			if (i & (size_t(1) << b)) {
+				r |= size_t(1) << (bits - 1 - b);
+			}
+		}
+		out.bitrev[i] = r;
+	}
+	out.twiddles = detail::make_twiddles(size, size / 2);
+	return out;
+}
+
+// In-place, unnormalized
+inline
+auto forward(const fft::plan& p, fft::complex* data) -> void {
+	const auto n = p.size;
+	for (size_t i = 0; i < n; i++) {
+		const auto j = p.bitrev[i];
+		if (i < j) {
+			std::swap(data[i], data[j]);
+		}
+	}
+	for (size_t len = 2; len <= n; len <<= 1) {
+		const auto half = len / 2;
+		const auto step = n / len;
+		for (size_t i = 0; i < n; i += len) {
+			for (size_t j = 0; j < half; j++) {
+				const auto u = data[i + j];
+				const auto v = data[i + j + half] * p.twiddles[j * step];
+				data[i + j]        = u + v;
+				data[i + j + half] = u - v;
+			}
+		}
+	}
+}
+
+// In-place, scaled by 1/size so that inverse(forward(x)) == x
+inline
+auto inverse(const fft::plan& p, fft::complex* data) -> void {
+	for (size_t i = 0; i < p.size; i++) {
+		data[i] = std::conj(data[i]);
+	}
+	forward(p, data);
+	const auto scale = 1.0f / float(p.size);
+	for (size_t i = 0; i < p.size; i++) {
+		data[i] = std::conj(data[i]) * scale;
+	}
+}
+
+// Real FFT of size n computed with a complex FFT of size n/2
+[[nodiscard]] inline
+auto make_real_plan(size_t size) -> fft::real_plan {
+	assert(is_pow2(size) && size >= 4);
+	fft::real_plan out;
+	out.size     = size;
+	out.half     = make_plan(size / 2);
+	out.twiddles = detail::make_twiddles(size, size / 2);
+	return out;
+}
+
+// in has size frames. out must have room for size/2 + 1 bins
+inline
+auto real_forward(const fft::real_plan& p, const float* in, fft::complex* out) -> void {
+	const auto half = p.size / 2;
+	for (size_t k = 0; k < half; k++) {
+		out[k] = {in[2 * k], in[2 * k + 1]};
+	}
+	forward(p.half, out);
+	const auto z0 = out[0];
+	out[0]    = {z0.real() + z0.imag(), 0.0f};
+	out[half] = {z0.real() - z0.imag(), 0.0f};
+	for (size_t k = 1; k <= half / 2; k++) {
+		const auto m  = half - k;
+		const auto zk = out[k];
+		const auto zm = out[m];
+		const auto e  = (zk + std::conj(zm)) * 0.5f;
+		const auto o  = (zk - std::conj(zm)) * fft::complex{0.0f, -0.5f};
+		out[k] = e + (p.twiddles[k] * o);
+		out[m] = std::conj(e) + (p.twiddles[m] * std::conj(o));
+	}
+}
+
+// in holds size/2 + 1 bins and is used as scratch space.
+// out receives size frames
+inline
+auto real_inverse(const fft::real_plan& p, fft::complex* in, float* out) -> void {
+	const auto half = p.size / 2;
+	for (size_t k = 0; k <= half / 2; k++) {
+		const auto m  = half - k;
+		const auto xk = in[k];
+		const auto xm = in[m];
+		const auto ek = (xk + std::conj(xm)) * 0.5f;
+		const auto ok = (xk - std::conj(xm)) * std::conj(p.twiddles[k]) * 0.5f;
+		in[k] = ek + (fft::complex{0.0f, 1.0f} * ok);
+		if (k > 0 && m != k) {
+			const auto em = (xm + std::conj(xk)) * 0.5f;
+			const auto om = (xm - std::conj(xk)) * std::conj(p.twiddles[m]) * 0.5f;
+			in[m] = em + (fft::complex{0.0f, 1.0f} * om);
+		}
+	}
+	inverse(p.half, in);
+	for (size_t k = 0; k < half; k++) {
+		out[2 * k]     = in[k].real();
+		out[2 * k + 1] = in[k].imag();
+	}
+}
+
+} // snd::fft
\ No newline at end of file
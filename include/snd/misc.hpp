@@ -4,6 +4,7 @@
 #	define _USE_MATH_DEFINES
 #endif
 #include <algorithm>
+#include <bit>
 #include <cmath>
 #include <cstdint>
 
@@ -77,6 +78,16 @@ constexpr T midpoint(T a, T b)
 	return (a + b) / T(2);
 }
 
+// a if c is true, otherwise b. GCC turns ?: (and std::min,
+// std::max and std::clamp) on floats back into branches when
+// it can, which stops loops being vectorized. It can't do that
+// with this.
+[[nodiscard]] inline
+auto select(bool c, float a, float b) -> float {
+	const auto mask = uint32_t(0) - uint32_t(c);
+	return std::bit_cast<float>((std::bit_cast<uint32_t>(a) & mask) | (std::bit_cast<uint32_t>(b) & ~mask));
+}
+
 template <class T> T quadratic_sequence(T step, T start, T n)
 {
 	auto a = T(0.5) * step;
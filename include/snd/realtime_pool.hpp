@@ -0,0 +1,184 @@
+#pragma once
+
+#include "thread_pool.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#include <immintrin.h>
+#endif
+
+namespace snd {
+namespace th {
+
+// Like thread_pool but for splitting work inside an audio
+// callback. parallel_for doesn't lock, allocate or make system
+// calls apart from waking up workers which have gone to sleep.
+//
+// Between jobs the workers busy-wait for spin_count polls and
+// then sleep on an atomic, so with a small spin_count they are
+// cheap when the audio is stopped and with a bigger one they
+// pick up the next vector sooner. The calling thread always
+// works on chunks itself, so a worker which is slow to wake up
+// (or which the OS never schedules) only means fewer threads
+// helping, never a missed job.
+//
+// Workers are started in the constructor. on_start is called
+// on each one before it does anything else, which is the
+// place to raise its priority to match the audio thread (or
+// join an audio workgroup) so that the audio thread doesn't
+// end up waiting on a low priority thread.
+//
+// parallel_for must only be called from one thread at a time.
+class realtime_pool {
+public:
+	static constexpr auto DEFAULT_SPIN_COUNT = size_t(20000);
+	explicit realtime_pool(size_t worker_count = thread_pool::default_worker_count(), size_t spin_count = DEFAULT_SPIN_COUNT, std::function<void()> on_start = {})
+		: spin_count_{spin_count}
+	{
+		workers_.reserve(worker_count);
+		for (size_t i = 0; i < worker_count; i++) {
+			workers_.emplace_back([this, on_start] {
+				if (on_start) {
+					on_start();
+				}
+				worker_loop();
+			});
+		}
+	}
+	~realtime_pool() {
+		quit_ = true;
+		generation_.fetch_add(1);
+		generation_.notify_all();
+		for (auto& worker : workers_) {
+			worker.join();
+		}
+	}
+	realtime_pool(const realtime_pool&) = delete;
+	realtime_pool& operator=(const realtime_pool&) = delete;
+	[[nodiscard]]
+	auto worker_count() const -> size_t {
+		return workers_.size();
+	}
+	// Calls fn(beg, end) for consecutive chunks of [0, n) and
+	// returns once they have all been processed. As with
+	// thread_pool, chunk boundaries only depend on n and
+	// chunk_size.
+	template <typename Fn>
+	auto parallel_for(size_t n, size_t chunk_size, Fn&& fn) -> void {
+		if (n == 0) {
+			return;
+		}
+		const auto chunk = std::max(size_t(1), chunk_size);
+		if (workers_.empty() || n <= chunk) {
+			for (size_t beg = 0; beg < n; beg += chunk) {
+				fn(beg, std::min(n, beg + chunk));
+			}
+			return;
+		}
+		job_.fn     = const_cast<void*>(static_cast<const void*>(&fn));
+		job_.invoke = [](void* fn, size_t beg, size_t end) { (*static_cast<std::remove_reference_t<Fn>*>(fn))(beg, end); };
+		job_.n      = n;
+		job_.chunk  = chunk;
+		job_.chunk_count = (n + chunk - 1) / chunk;
+		job_.next.store(0, std::memory_order_relaxed);
+		job_.done.store(0, std::memory_order_relaxed);
+		open_.store(true);
+		generation_.fetch_add(1);
+		generation_.notify_all();
+		run(&job_);
+		for (size_t i = 0;; i++) {
+			const auto done = job_.done.load(std::memory_order_acquire);
+			if (done == job_.chunk_count) {
+				break;
+			}
+			if (i < spin_count_) { pause(); }
+			else                 { job_.done.wait(done, std::memory_order_acquire); }
+		}
+		// A worker might have woken up just now and be about to
+		// look at the job. Close it and wait for any stragglers
+		// to see that before the job can be reused.
+		open_.store(false);
+		for (size_t i = 0;; i++) {
+			const auto active = active_.load();
+			if (active == 0) {
+				break;
+			}
+			if (i < spin_count_) { pause(); }
+			else                 { active_.wait(active); }
+		}
+	}
+private:
+	struct job {
+		void* fn = nullptr;
+		void (*invoke)(void*, size_t, size_t) = nullptr;
+		size_t n           = 0;
+		size_t chunk       = 1;
+		size_t chunk_count = 0;
+		std::atomic<size_t> next = 0;
+		std::atomic<size_t> done = 0;
+	};
+	static
+	auto pause() -> void {
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+		_mm_pause();
+#else
+		std::this_thread::yield();
+#endif
+	}
+	static
+	auto run(job* j) -> void {
+		for (;;) {
+			const auto beg = j->next.fetch_add(j->chunk, std::memory_order_relaxed);
+			if (beg >= j->n) {
+				return;
+			}
+			j->invoke(j->fn, beg, std::min(j->n, beg + j->chunk));
+			if (j->done.fetch_add(1, std::memory_order_acq_rel) + 1 == j->chunk_count) {
+				j->done.notify_one();
+			}
+		}
+	}
+	auto worker_loop() -> void {
+		auto seen_generation = generation_.load();
+		for (;;) {
+			for (size_t i = 0;; i++) {
+				const auto generation = generation_.load(std::memory_order_acquire);
+				if (generation != seen_generation) {
+					seen_generation = generation;
+					break;
+				}
+				if (i < spin_count_) { pause(); }
+				else                 { generation_.wait(generation, std::memory_order_acquire); }
+			}
+			if (quit_) {
+				return;
+			}
+			// Pairs with the end of parallel_for: either the
+			// caller sees this worker as active, or this worker
+			// sees that the job is closed
+			active_.fetch_add(1);
+			if (open_.load()) {
+				run(&job_);
+			}
+			if (active_.fetch_sub(1) == 1) {
+				active_.notify_one();
+			}
+		}
+	}
+	std::vector<std::thread> workers_;
+	size_t spin_count_;
+	job job_;
+	std::atomic<uint32_t> generation_ = 0;
+	std::atomic<size_t> active_ = 0;
+	std::atomic<bool> open_ = false;
+	std::atomic<bool> quit_ = false;
+};
+
+} // th
+} // snd
@@ -0,0 +1,170 @@
+#pragma once
+
+#include "../interpolation.hpp"
+#include "../storage/frame_data.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+#if !defined(__GNUC__) && (defined(_M_X64) || defined(_M_IX86))
+#include <immintrin.h>
+#endif
+
+namespace snd {
+namespace sample_reader {
+
+// Reads interpolated frames at a vector of (fractional) frame
+// positions, e.g. the grain positions passed to the bulk
+// read_samples_fn of fudge::process():
+//
+//   [&](int channel, const float* positions, size_t count, float* out) {
+//     sample_reader::read<sample_reader::quality::cubic>(spans[channel], positions, count, out);
+//   }
+//
+// Frames outside the data read as zero. When every position
+// in a call is far enough from the edges (the usual case) the
+// frames are read with no checks at all, otherwise every tap is
+// clamped and masked, so there are never any branches per
+// frame. Positions in a call don't have to be in order but the
+// readers are written for playheads, which are.
+//
+// After reading, the cache lines the same playhead will want
+// next time are prefetched.
+enum class quality { none, linear, cubic };
+
+struct span {
+	const float* frames = nullptr;
+	size_t size         = 0;
+};
+
+namespace detail {
+
+// The frames before and after floor(position) that are read
+template <quality Q> struct taps;
+template <> struct taps<quality::none>   { static constexpr auto BEFORE = int64_t(0); static constexpr auto AFTER = int64_t(0); };
+template <> struct taps<quality::linear> { static constexpr auto BEFORE = int64_t(0); static constexpr auto AFTER = int64_t(1); };
+template <> struct taps<quality::cubic>  { static constexpr auto BEFORE = int64_t(1); static constexpr auto AFTER = int64_t(2); };
+
+template <quality Q>
+static constexpr auto TAP_COUNT = size_t(taps<Q>::BEFORE + 1 + taps<Q>::AFTER);
+
+// How far past the last position to prefetch, at most
+static constexpr auto MAX_PREFETCH_FRAMES = int64_t(256);
+static constexpr auto FLOATS_PER_CACHE_LINE = int64_t(64 / sizeof(float));
+
+// std::floor without the library call
+[[nodiscard]] inline
+auto floor_index(float x) -> int64_t {
+	const auto i = int64_t(x);
+	return i - int64_t(float(i) > x);
+}
+
+// p points at the frame at floor(position) and t is the
+// fractional part
+template <quality Q> [[nodiscard]]
+auto interpolate(const float* p, float t) -> float {
+	if constexpr (Q == quality::none)   { return p[0]; }
+	if constexpr (Q == quality::linear) { return p[0] + (t * (p[1] - p[0])); }
+	if constexpr (Q == quality::cubic)  { return interpolation::interp_4pt(p[-1], p[0], p[1], p[2], t); }
+}
+
+struct position_range {
+	float min;
+	float max;
+};
+
+[[nodiscard]] inline
+auto get_range(const float* positions, size_t count) -> position_range {
+	position_range out{positions[0], positions[0]};
+	for (size_t i = 1; i < count; i++) {
+		out.min = std::min(out.min, positions[i]);
+		out.max = std::max(out.max, positions[i]);
+	}
+	return out;
+}
+
+// True if every tap of every position in the range is a frame
+// in [beg, end)
+template <quality Q> [[nodiscard]]
+auto is_inside(position_range r, int64_t beg, int64_t end) -> bool {
+	return
+		double(r.min) >= double(beg + taps<Q>::BEFORE) &&
+		double(r.max) <  double(end - taps<Q>::AFTER);
+}
+
+// frames points at frame origin. Every tap must be inside the
+// data.
+template <quality Q>
+auto read_inside(const float* frames, int64_t origin, const float* positions, size_t count, float* out) -> void {
+	for (size_t i = 0; i < count; i++) {
+		const auto index = floor_index(positions[i]);
+		out[i] = interpolate<Q>(frames + (index - origin), positions[i] - float(index));
+	}
+}
+
+// Taps outside [0, size) read as zero
+template <quality Q>
+auto read_clamped(const float* frames, int64_t size, const float* positions, size_t count, float* out) -> void {
+	for (size_t i = 0; i < count; i++) {
+		const auto index = floor_index(positions[i]);
+		float values[TAP_COUNT<Q>];
+		for (int64_t k = 0; k < int64_t(TAP_COUNT<Q>); k++) {
+			const auto tap     = index - taps<Q>::BEFORE + k;
+			const auto clamped = std::clamp(tap, int64_t(0), size - 1);
+			values[k] = frames[clamped] * float(tap == clamped);
+		}
+		out[i] = interpolate<Q>(values + taps<Q>::BEFORE, positions[i] - float(index));
+	}
+}
+
+inline
+auto prefetch(const float* p) -> void {
+#if defined(__GNUC__)
+	__builtin_prefetch(p);
+#elif defined(_M_X64) || defined(_M_IX86)
+	_mm_prefetch(reinterpret_cast<const char*>(p), _MM_HINT_T0);
+#endif
+}
+
+// Prefetches the frames after the last position, as far
+// again as the positions moved in this call. frames points at
+// frame origin and nothing at or after limit is touched.
+template <quality Q>
+auto prefetch_ahead(const float* frames, int64_t origin, int64_t limit, const float* positions, size_t count) -> void {
+	const auto last     = positions[count - 1];
+	const auto distance = std::clamp(int64_t(std::abs(last - positions[0])), FLOATS_PER_CACHE_LINE, MAX_PREFETCH_FRAMES);
+	const auto beg      = std::max(origin, floor_index(last) + taps<Q>::AFTER + 1);
+	const auto end      = std::min(limit, beg + distance);
+	for (auto frame = beg; frame < end; frame += FLOATS_PER_CACHE_LINE) {
+		prefetch(frames + (frame - origin));
+	}
+}
+
+} // detail
+
+template <quality Q>
+auto read(sample_reader::span s, const float* positions, size_t count, float* out) -> void {
+	if (count == 0) {
+		return;
+	}
+	if (s.size == 0) {
+		std::fill(out, out + count, 0.0f);
+		return;
+	}
+	const auto range = detail::get_range(positions, count);
+	if (detail::is_inside<Q>(range, 0, int64_t(s.size))) {
+		detail::read_inside<Q>(s.frames, 0, positions, count, out);
+	}
+	else {
+		detail::read_clamped<Q>(s.frames, int64_t(s.size), positions, count, out);
+	}
+	detail::prefetch_ahead<Q>(s.frames, 0, int64_t(s.size), positions, count);
+}
+
+template <quality Q, class Allocator>
+auto read(const storage::FrameData<float, Allocator>& data, ChannelCount channel, const float* positions, size_t count, float* out) -> void {
+	read<Q>(sample_reader::span{data[channel].data(), data[channel].size()}, positions, count, out);
+}
+
+} // sample_reader
+} // snd
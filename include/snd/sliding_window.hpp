@@ -0,0 +1,146 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <utility>
+
+namespace snd::sliding_window {
+
+// Sum of a window which slides forwards over a signal. The
+// sum is kept in double precision so that adding and
+// removing millions of values doesn't drift noticeably
+// relative to a fresh float summation of the same window.
+struct running_sum {
+	double sum   = 0.0;
+	size_t count = 0;
+};
+
+inline
+auto push(running_sum* rs, float value) -> void {
+	rs->sum += value;
+	rs->count++;
+}
+
+inline
+auto pop(running_sum* rs, float value) -> void {
+	rs->sum -= value;
+	rs->count--;
+}
+
+[[nodiscard]] inline
+auto mean(const running_sum& rs) -> float {
+	return float(rs.sum / double(rs.count));
+}
+
+[[nodiscard]] inline
+auto centered_window_beg(size_t index, size_t radius) -> size_t {
+	return index > radius ? index - radius : 0;
+}
+
+[[nodiscard]] inline
+auto centered_window_end(size_t size, size_t index, size_t radius) -> size_t {
+	return std::min(size, index + radius);
+}
+
+// For each index i in [beg, end), writes the mean of
+// in[c][max(0, i - radius), min(size, i + radius)) to
+// out[c][i], for each of N signals of the same size.
+//
+// This is O(end - beg + radius) instead of O((end - beg) * radius).
+// Each call starts a fresh sum so long inputs can be processed
+// in chunks. The double sum may then round differently, so a
+// chunked result can differ from a single pass in the last bit
+// or so (it is usually identical).
+//
+// Each sum is a chain of dependent additions, so stepping all
+// N of them through one loop lets them overlap and N signals
+// cost little more than one. The results are the same as N
+// separate calls.
+template <size_t N>
+auto centered_mean(const std::array<const float*, N>& in, size_t size, size_t radius, size_t beg, size_t end, const std::array<float*, N>& out) -> void {
+	if (beg >= end) {
+		return;
+	}
+	std::array<running_sum, N> rs;
+	auto window_beg = centered_window_beg(beg, radius);
+	auto window_end = centered_window_end(size, beg, radius);
+	for (size_t i = window_beg; i < window_end; i++) {
+		for (size_t c = 0; c < N; c++) { push(&rs[c], in[c][i]); }
+	}
+	const auto step = [&](size_t i) {
+		const auto next_beg = centered_window_beg(i, radius);
+		const auto next_end = centered_window_end(size, i, radius);
+		for (; window_end < next_end; window_end++) {
+			for (size_t c = 0; c < N; c++) { push(&rs[c], in[c][window_end]); }
+		}
+		for (; window_beg < next_beg; window_beg++) {
+			for (size_t c = 0; c < N; c++) { pop(&rs[c], in[c][window_beg]); }
+		}
+		for (size_t c = 0; c < N; c++) { out[c][i] = mean(rs[c]); }
+	};
+	// Away from the edges the window moves along by exactly one
+	// frame each time, so there is nothing to work out apart from
+	// the sums. They are unpacked so that they can stay in
+	// registers.
+	const auto interior_beg = std::clamp(radius + 1, beg + 1, end);
+	const auto interior_end = std::clamp(size + 1 > radius ? size + 1 - radius : 0, interior_beg, end);
+	auto i = beg;
+	for (; i < interior_beg; i++) {
+		step(i);
+	}
+	if (i < interior_end) {
+		const auto count = double(rs[0].count);
+		std::array<double, N> sums;
+		for (size_t c = 0; c < N; c++) { sums[c] = rs[c].sum; }
+		[&]<size_t... C>(std::index_sequence<C...>) {
+			for (; i < interior_end; i++) {
+				((sums[C] += in[C][i + radius - 1]), ...);
+				((sums[C] -= in[C][i - radius - 1]), ...);
+				((out[C][i] = float(sums[C] / count)), ...);
+			}
+		}(std::make_index_sequence<N>{});
+		for (size_t c = 0; c < N; c++) { rs[c].sum = sums[c]; }
+		window_beg = centered_window_beg(i - 1, radius);
+		window_end = centered_window_end(size, i - 1, radius);
+	}
+	for (; i < end; i++) {
+		step(i);
+	}
+}
+
+inline
+auto centered_mean(const float* in, size_t size, size_t radius, size_t beg, size_t end, float* out) -> void {
+	centered_mean<1>({in}, size, radius, beg, end, {out});
+}
+
+inline
+auto centered_mean(const float* in, size_t size, size_t radius, float* out) -> void {
+	centered_mean(in, size, radius, 0, size, out);
+}
+
+// Centered mean over a signal which arrives a bit at a time.
+// Call next() for consecutive indices starting at 0. For index
+// i, value_at must be valid for [max(0, i - radius), min(size, i + radius)),
+// where size is either the final size of the signal or anything
+// >= i + radius if it isn't known yet. Nothing before
+// window_beg is read again, so callers can discard it.
+struct centered_mean_stream {
+	running_sum rs;
+	size_t radius     = 0;
+	size_t window_beg = 0;
+	size_t window_end = 0;
+	size_t index      = 0;
+};
+
+template <typename ValueFn> [[nodiscard]]
+auto next(centered_mean_stream* s, size_t size, ValueFn&& value_at) -> float {
+	const auto next_beg = centered_window_beg(s->index, s->radius);
+	const auto next_end = centered_window_end(size, s->index, s->radius);
+	for (; s->window_end < next_end; s->window_end++) { push(&s->rs, value_at(s->window_end)); }
+	for (; s->window_beg < next_beg; s->window_beg++) { pop(&s->rs, value_at(s->window_beg)); }
+	s->index++;
+	return mean(s->rs);
+}
+
+} // snd::sliding_window
\ No newline at end of file
@@ -0,0 +1,151 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+namespace snd {
+namespace th {
+
+// A fixed set of worker threads for splitting non-realtime
+// jobs (e.g. sample analysis) across cores. Don't use this
+// from the audio thread: parallel_for locks a mutex and
+// blocks until every chunk is finished (see realtime_pool for
+// that).
+class thread_pool {
+public:
+	explicit thread_pool(size_t worker_count = default_worker_count()) {
+		workers_.reserve(worker_count);
+		for (size_t i = 0; i < worker_count; i++) {
+			workers_.emplace_back([this] { worker_loop(); });
+		}
+	}
+	~thread_pool() {
+		{
+			std::lock_guard lock{mutex_};
+			quit_ = true;
+		}
+		wake_.notify_all();
+		for (auto& worker : workers_) {
+			worker.join();
+		}
+	}
+	thread_pool(const thread_pool&) = delete;
+	thread_pool& operator=(const thread_pool&) = delete;
+	[[nodiscard]] static
+	auto default_worker_count() -> size_t {
+		const auto hw = size_t(std::thread::hardware_concurrency());
+		return hw > 1 ? hw - 1 : 0;
+	}
+	[[nodiscard]]
+	auto worker_count() const -> size_t {
+		return workers_.size();
+	}
+	// Calls fn(beg, end) for consecutive chunks of [0, n). The
+	// calling thread works on chunks too. Chunks are claimed
+	// one at a time from a shared counter so a thread which
+	// finishes early just takes the next one. Chunk boundaries
+	// only depend on n and chunk_size, never on timing. Returns
+	// once every chunk has been processed.
+	template <typename Fn>
+	auto parallel_for(size_t n, size_t chunk_size, Fn&& fn) -> void {
+		submit(n, chunk_size, fn, [this](std::unique_lock<std::mutex>* lock) {
+			done_.wait(*lock, [this] { return busy_workers_ == 0; });
+		});
+	}
+	// The same, but once the calling thread runs out of chunks
+	// it calls poll() every interval until the other threads
+	// have finished theirs, e.g. to check whether the user has
+	// cancelled or to report progress.
+	template <typename Fn, typename PollFn, typename Rep, typename Period>
+	auto parallel_for(size_t n, size_t chunk_size, Fn&& fn, PollFn&& poll, std::chrono::duration<Rep, Period> interval) -> void {
+		submit(n, chunk_size, fn, [this, &poll, interval](std::unique_lock<std::mutex>* lock) {
+			while (!done_.wait_for(*lock, interval, [this] { return busy_workers_ == 0; })) {
+				lock->unlock();
+				poll();
+				lock->lock();
+			}
+		});
+	}
+private:
+	struct job {
+		void* fn = nullptr;
+		void (*invoke)(void*, size_t, size_t) = nullptr;
+		size_t n     = 0;
+		size_t chunk = 1;
+		std::atomic<size_t> next = 0;
+	};
+	template <typename Fn, typename WaitFn>
+	auto submit(size_t n, size_t chunk_size, Fn& fn, WaitFn wait) -> void {
+		if (n == 0) {
+			return;
+		}
+		std::lock_guard submit_lock{submit_mutex_};
+		job j;
+		j.fn     = const_cast<void*>(static_cast<const void*>(&fn));
+		j.invoke = [](void* fn, size_t beg, size_t end) { (*static_cast<Fn*>(fn))(beg, end); };
+		j.n      = n;
+		j.chunk  = std::max(size_t(1), chunk_size);
+		{
+			std::lock_guard lock{mutex_};
+			job_ = &j;
+			generation_++;
+			busy_workers_ = workers_.size();
+		}
+		wake_.notify_all();
+		run(&j);
+		std::unique_lock lock{mutex_};
+		wait(&lock);
+		job_ = nullptr;
+	}
+	static
+	auto run(job* j) -> void {
+		for (;;) {
+			const auto beg = j->next.fetch_add(j->chunk);
+			if (beg >= j->n) {
+				return;
+			}
+			j->invoke(j->fn, beg, std::min(j->n, beg + j->chunk));
+		}
+	}
+	auto worker_loop() -> void {
+		uint64_t seen_generation = 0;
+		for (;;) {
+			job* j;
+			{
+				std::unique_lock lock{mutex_};
+				wake_.wait(lock, [this, seen_generation] { return quit_ || generation_ != seen_generation; });
+				if (quit_) {
+					return;
+				}
+				seen_generation = generation_;
+				j = job_;
+			}
+			run(j);
+			{
+				std::lock_guard lock{mutex_};
+				if (--busy_workers_ == 0) {
+					done_.notify_one();
+				}
+			}
+		}
+	}
+	std::vector<std::thread> workers_;
+	std::mutex submit_mutex_;
+	std::mutex mutex_;
+	std::condition_variable wake_;
+	std::condition_variable done_;
+	job* job_ = nullptr;
+	uint64_t generation_ = 0;
+	size_t busy_workers_ = 0;
+	bool quit_ = false;
+};
+
+} // th
+} // snd
\ No newline at end of file
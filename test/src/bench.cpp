@@ -0,0 +1,297 @@
+#define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
+#include "doctest.h"
+#include "snd/audio/fdn.hpp"
+#include "snd/audio/fudge_bank.hpp"
+#include "snd/audio/wavebender.hpp"
+#include "snd/sliding_window.hpp"
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <limits>
+#include <memory>
+#include <numeric>
+#include <random>
+#include <vector>
+
+// Timings only mean anything in an optimized build. Each
+// benchmark runs a few times and reports the fastest run,
+// which is the least disturbed by whatever else the machine
+// is doing.
+
+namespace {
+
+constexpr auto BENCH_SR   = 48000;
+constexpr auto BENCH_RUNS = 5;
+
+// Fastest time in nanoseconds for one call of fn, out of
+// runs runs of calls calls each
+template <typename Fn>
+auto best_ns_per_call(size_t calls, Fn&& fn, int runs = BENCH_RUNS) -> double {
+	auto best = std::numeric_limits<double>::max();
+	for (int run = 0; run < runs; run++) {
+		const auto beg = std::chrono::steady_clock::now();
+		for (size_t i = 0; i < calls; i++) {
+			fn();
+		}
+		const auto end = std::chrono::steady_clock::now();
+		best = std::min(best, std::chrono::duration<double, std::nano>(end - beg).count() / double(calls));
+	}
+	return best;
+}
+
+auto make_noise(size_t size, float amp, uint32_t seed) -> std::vector<float> {
+	std::mt19937 rng(seed);
+	std::uniform_real_distribution<float> dist(-amp, amp);
+	std::vector<float> out(size);
+	for (auto& value : out) {
+		value = dist(rng);
+	}
+	return out;
+}
+
+// The share of one core used by something costing ns per
+// 64 frame block, running in realtime at BENCH_SR
+auto core_percent(double ns_per_block) -> double {
+	const auto block_ns = 1e9 * double(kFloatsPerDSPVector) / double(BENCH_SR);
+	return 100.0 * ns_per_block / block_ns;
+}
+
+// Keeps results alive so the optimizer can't drop the work
+volatile float sink;
+
+} // namespace
+
+template <size_t N>
+auto bench_fdn() -> void {
+	snd::audio::FDN<N> fdn(BENCH_SR, size_t(BENCH_SR / 10));
+	fdn.set_decay(2.0f);
+	ml::DSPVectorArray<2> in;
+	for (int i = 0; i < kFloatsPerDSPVector; i++) {
+		in.row(0)[i] = float(i % 7) * 0.1f;
+		in.row(1)[i] = float(i % 5) * 0.1f;
+	}
+	const auto ns = best_ns_per_call(20000, [&fdn, &in] {
+		sink = fdn(in).constRow(0)[0];
+	});
+	std::printf("FDN<%zu>: %.0f ns per block (%.2f%% of one core per voice)\n", N, ns, core_percent(ns));
+}
+
+TEST_CASE("FDN per-voice cost") {
+	bench_fdn<8>();
+	bench_fdn<16>();
+}
+
+// The per-frame window summation which poka used before
+// sliding_window, for comparison
+auto naive_centered_mean(const std::vector<float>& in, size_t radius, std::vector<float>* out) -> void {
+	for (size_t i = 0; i < in.size(); i++) {
+		const auto beg = snd::sliding_window::centered_window_beg(i, radius);
+		const auto end = snd::sliding_window::centered_window_end(in.size(), i, radius);
+		const auto sum = std::accumulate(in.begin() + beg, in.begin() + end, 0.0f);
+		(*out)[i] = sum / float(end - beg);
+	}
+}
+
+TEST_CASE("sliding window centered mean on 10 minutes of audio") {
+	constexpr auto SR = size_t(44100);
+	constexpr auto CHUNK_SIZE = size_t(4096);
+	const auto in = make_noise(SR * 60 * 10, 1.0f, 1);
+	std::vector<float> out(in.size());
+	// The pre and post smoothing windows used by poka. The naive
+	// version is too slow to run more than once.
+	for (const auto radius : {size_t(3), SR / 100}) {
+		const auto naive_ns = best_ns_per_call(1, [&in, &out, radius] {
+			naive_centered_mean(in, radius, &out);
+		}, 1);
+		const auto ns = best_ns_per_call(1, [&in, &out, radius] {
+			for (size_t beg = 0; beg < in.size(); beg += CHUNK_SIZE) {
+				snd::sliding_window::centered_mean(in.data(), in.size(), radius, beg, std::min(in.size(), beg + CHUNK_SIZE), out.data());
+			}
+		});
+		std::printf("centered mean, radius %zu: %.3fs naive, %.3fs sliding window\n", radius, naive_ns * 1e-9, ns * 1e-9);
+	}
+}
+
+namespace {
+
+// A stereo sample read with linear interpolation, one frame at a
+// time for fudge::process() and a run at a time for the vector
+// version
+struct bench_sample {
+	std::array<std::vector<float>, 2> channels;
+	auto read(int channel, float pos) const -> float {
+		const auto& data = channels[size_t(channel)];
+		const auto index = size_t(pos);
+		if (index + 1 >= data.size()) {
+			return 0.0f;
+		}
+		return snd::lerp(data[index], data[index + 1], pos - float(index));
+	}
+	auto read(int channel, const float* pos, size_t count, float* out) const -> void {
+		for (size_t i = 0; i < count; i++) {
+			out[i] = read(channel, pos[i]);
+		}
+	}
+};
+
+auto make_fudge_info(const bench_sample& sample, float size) -> snd::fudge::vector_info {
+	using namespace snd;
+	fudge::vector_info v;
+	for (int i = 0; i < kFloatsPerDSPVector; i++) {
+		v.amp.value[i]             = 0.5f + (0.5f * float(i % 8) / 8.0f);
+		v.ff.value[i]              = 1.0f;
+		v.harmonic_ratio.value[i]  = 1.0f;
+		v.size.value[i]            = size;
+		v.uniformity.value[i]      = 1.0f;
+		v.sample_position.value[i] = snd::frame_pos{double(1000 + (i * 10))};
+	}
+	v.channel_count      = {2};
+	v.channel_mode       = fudge::channel_mode::stereo;
+	v.frame_increment    = {1.0f};
+	v.sample_frame_count = {sample.channels[0].size()};
+	v.SR                 = {BENCH_SR};
+	return v;
+}
+
+} // namespace
+
+TEST_CASE("fudge per-frame and vector cost") {
+	using namespace snd;
+	bench_sample sample;
+	sample.channels[0] = make_noise(size_t(BENCH_SR * 4), 1.0f, 1);
+	sample.channels[1] = make_noise(size_t(BENCH_SR * 4), 1.0f, 2);
+	const auto read_frame = [&sample](int channel, float pos) {
+		return sample.read(channel, pos);
+	};
+	const auto read_samples = [&sample](int channel, const float* pos, size_t count, float* out) {
+		sample.read(channel, pos, count, out);
+	};
+	fudge::vector_flags flags;
+	for (auto& f : flags.value) {
+		f.value = fudge::frame_flags::play;
+	}
+	for (const auto size : {200.0f, 2000.0f}) {
+		const auto v = make_fudge_info(sample, size);
+		fudge::particle frame_p;
+		fudge::particle vector_p;
+		// Taking turns, so that both see the machine in the same
+		// state
+		auto frame_ns  = std::numeric_limits<double>::max();
+		auto vector_ns = std::numeric_limits<double>::max();
+		for (int run = 0; run < 500; run++) {
+			frame_ns = std::min(frame_ns, best_ns_per_call(200, [&] {
+				auto sum = 0.0f;
+				for (int i = 0; i < kFloatsPerDSPVector; i++) {
+					const auto frame = fudge::process(&frame_p, v, fudge::frame_info{flags.value[i], i}, read_frame);
+					sum += frame.L + frame.R;
+				}
+				sink = sum;
+			}, 1));
+			vector_ns = std::min(vector_ns, best_ns_per_call(200, [&] {
+				const auto out = fudge::process(&vector_p, v, flags, read_samples);
+				auto sum = 0.0f;
+				for (int i = 0; i < kFloatsPerDSPVector; i++) {
+					sum += out.constRow(0)[i] + out.constRow(1)[i];
+				}
+				sink = sum;
+			}, 1));
+		}
+		std::printf("fudge, grain size %.0f: %.1f ns per frame per-frame, %.1f ns per frame vector\n",
+			size, frame_ns / kFloatsPerDSPVector, vector_ns / kFloatsPerDSPVector);
+	}
+}
+
+TEST_CASE("fudge bank cost on one thread and on a realtime pool") {
+	using namespace snd;
+	constexpr auto VOICES = size_t(32);
+	bench_sample sample;
+	sample.channels[0] = make_noise(size_t(BENCH_SR * 4), 1.0f, 1);
+	sample.channels[1] = make_noise(size_t(BENCH_SR * 4), 1.0f, 2);
+	const auto read_samples = [&sample](size_t, int channel, const float* pos, size_t count, float* out) {
+		sample.read(channel, pos, count, out);
+	};
+	std::vector<fudge::vector_info> info;
+	for (size_t v = 0; v < VOICES; v++) {
+		info.push_back(make_fudge_info(sample, 200.0f + (50.0f * float(v))));
+	}
+	fudge::bank_block<VOICES> block;
+	for (size_t v = 0; v < VOICES; v++) {
+		block.info[v] = &info[v];
+		for (auto& f : block.flags[v].value) {
+			f.value = fudge::frame_flags::play;
+		}
+	}
+	const auto serial_bank   = std::make_unique<fudge::bank<VOICES>>();
+	const auto parallel_bank = std::make_unique<fudge::bank<VOICES>>();
+	for (size_t v = 0; v < VOICES; v++) {
+		(void)fudge::allocate(serial_bank.get());
+		(void)fudge::allocate(parallel_bank.get());
+	}
+	th::realtime_pool pool;
+	auto renderer = audio::voices::make_renderer<2>(VOICES, 4);
+	const auto serial_ns = best_ns_per_call(2000, [&] {
+		sink = fudge::render(serial_bank.get(), block, read_samples).constRow(0)[0];
+	});
+	const auto parallel_ns = best_ns_per_call(2000, [&] {
+		sink = fudge::render(parallel_bank.get(), block, &renderer, &pool, read_samples).constRow(0)[0];
+	});
+	std::printf("fudge bank, %zu voices: %.0f ns per block on one thread, %.0f ns per block with %zu workers (%.2fx)\n",
+		VOICES, serial_ns, parallel_ns, pool.worker_count(), serial_ns / parallel_ns);
+}
+
+TEST_CASE("wavebender per-frame and vector cost") {
+	using namespace snd;
+	// A few seconds of a wobbly tone, so that there are cycles of
+	// different lengths to bend
+	constexpr auto FRAMES = size_t(BENCH_SR * 4);
+	std::vector<float> in(FRAMES);
+	auto phase = 0.0f;
+	for (size_t i = 0; i < FRAMES; i++) {
+		const auto freq = 220.0f + (30.0f * std::sin(float(i) * 0.0001f));
+		phase += freq / float(BENCH_SR);
+		in[i] = std::sin(phase * 6.2831853f) + (0.2f * std::sin(phase * 18.849556f));
+	}
+	wavebender::FrameWriteParams write_params;
+	wavebender::FrameReadParams read_params;
+	read_params.tilt  = 0.3f;
+	read_params.spike = 0.2f;
+	read_params.ff    = 1.5f;
+	wavebender::Channel frame_c;
+	wavebender::Channel vector_c;
+	wavebender::init(&frame_c, BENCH_SR);
+	wavebender::init(&vector_c, BENCH_SR);
+	size_t frame_pos  = 0;
+	size_t vector_pos = 0;
+	// Taking turns, so that both see the machine in the same
+	// state
+	auto frame_ns  = std::numeric_limits<double>::max();
+	auto vector_ns = std::numeric_limits<double>::max();
+	for (int run = 0; run < 200; run++) {
+		frame_ns = std::min(frame_ns, best_ns_per_call(200, [&] {
+			auto sum = 0.0f;
+			for (int i = 0; i < kFloatsPerDSPVector; i++) {
+				const auto value = in[frame_pos];
+				sum += wavebender::process(&frame_c, write_params, read_params, value, value);
+				frame_pos = (frame_pos + 1) % FRAMES;
+			}
+			sink = sum;
+		}, 1));
+		vector_ns = std::min(vector_ns, best_ns_per_call(200, [&] {
+			ml::DSPVector block;
+			for (int i = 0; i < kFloatsPerDSPVector; i++) {
+				block[i] = in[vector_pos];
+				vector_pos = (vector_pos + 1) % FRAMES;
+			}
+			const auto out = wavebender::process(&vector_c, write_params, read_params, block, block);
+			auto sum = 0.0f;
+			for (int i = 0; i < kFloatsPerDSPVector; i++) {
+				sum += out[i];
+			}
+			sink = sum;
+		}, 1));
+	}
+	std::printf("wavebender: %.1f ns per frame per-frame, %.1f ns per frame vector\n",
+		frame_ns / kFloatsPerDSPVector, vector_ns / kFloatsPerDSPVector);
+}
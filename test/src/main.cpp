@@ -1,7 +1,285 @@
 #define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
 #include "doctest.h"
 #include "snd/ease.hpp"
+#include "snd/sliding_window.hpp"
+#include "snd/audio/autocorrelation_compact.hpp"
+#include "snd/audio/autocorrelation_stream.hpp"
+#include "snd/audio/fudge_bank.hpp"
+#include "snd/audio/fudge_cloud.hpp"
+#include <array>
+#include <cmath>
+#include <memory>
+#include <random>
+#include <vector>
 
 TEST_CASE("easing functions") {
 	REQUIRE(snd::ease(0.0, snd::easing::curve::quadratic, snd::easing::mode::in_out, 0.0) == 0);
 }
+
+TEST_CASE("sliding window centered mean") {
+	std::vector<float> in(1000);
+	for (size_t i = 0; i < in.size(); i++) {
+		in[i] = std::sin(float(i) * 0.1f) + float(i % 7);
+	}
+	for (const size_t radius : {size_t(1), size_t(3), size_t(50), size_t(2000)}) {
+		std::vector<float> whole(in.size());
+		std::vector<float> chunked(in.size());
+		snd::sliding_window::centered_mean(in.data(), in.size(), radius, whole.data());
+		for (size_t beg = 0; beg < in.size(); beg += 64) {
+			snd::sliding_window::centered_mean(in.data(), in.size(), radius, beg, std::min(in.size(), beg + 64), chunked.data());
+		}
+		for (size_t i = 0; i < in.size(); i++) {
+			const auto beg = i > radius ? i - radius : 0;
+			const auto end = std::min(in.size(), i + radius);
+			double sum = 0.0;
+			for (size_t j = beg; j < end; j++) {
+				sum += in[j];
+			}
+			REQUIRE(whole[i] == doctest::Approx(sum / double(end - beg)).epsilon(1e-5));
+			REQUIRE(chunked[i] == doctest::Approx(whole[i]).epsilon(1e-6));
+		}
+	}
+}
+
+TEST_CASE("poka compact output stays within tolerance") {
+	// Jittery per-cycle ramps, blurred like the post smoothing
+	std::mt19937 rng(1);
+	std::uniform_real_distribution<float> jitter(-20.0f, 20.0f);
+	std::vector<float> ramps;
+	auto size = 300.0f;
+	while (ramps.size() < 200000) {
+		const auto next = std::clamp(size + jitter(rng), 20.0f, 4000.0f);
+		const auto len  = size_t(size);
+		for (size_t i = 0; i < len; i++) {
+			ramps.push_back(size + ((next - size) * float(i) / float(len)));
+		}
+		size = next;
+	}
+	snd::poka::output dense;
+	dense.frames.estimated_size.resize(ramps.size());
+	snd::sliding_window::centered_mean(ramps.data(), ramps.size(), 441, dense.frames.estimated_size.data());
+	for (const auto tolerance : {snd::poka::COMPACT_TOLERANCE, 0.001f, 0.1f}) {
+		const auto compact = snd::poka::compact(dense, tolerance);
+		auto max_error = 0.0f;
+		for (size_t i = 0; i < ramps.size(); i++) {
+			max_error = std::max(max_error, std::abs(snd::poka::estimated_size(compact, i) - dense.frames.estimated_size[i]));
+		}
+		REQUIRE(compact.frames.size() < ramps.size() / 2);
+		REQUIRE(max_error <= tolerance);
+		if (tolerance == snd::poka::COMPACT_TOLERANCE) {
+			// At least ten times smaller, at 8 bytes per breakpoint
+			INFO("breakpoints " << compact.frames.size());
+			REQUIRE(compact.frames.size() * 2 * 10 <= ramps.size());
+		}
+	}
+}
+
+namespace {
+
+// A tone gliding from 110 to 160 Hz
+auto make_glide(size_t SR, size_t frame_count) -> std::vector<float> {
+	std::vector<float> out(frame_count);
+	auto phase = 0.0;
+	for (size_t i = 0; i < frame_count; i++) {
+		const auto t = double(i) / double(frame_count);
+		phase += (110.0 + (50.0 * t)) / double(SR);
+		out[i] = float(std::sin(phase * 2.0 * M_PI) + (0.3 * std::sin(phase * 6.0 * M_PI)));
+	}
+	return out;
+}
+
+template <snd::poka::mode Mode>
+auto check_stream_matches_offline(const std::vector<float>& in, size_t SR, size_t depth, size_t chunk_size) -> void {
+	using namespace snd;
+	const auto get_frames = [&in](size_t beg, size_t count, float* out) {
+		std::copy(in.begin() + beg, in.begin() + beg + count, out);
+	};
+	const auto cbs = poka::make_cbs(get_frames, [](float) {}, [] { return false; });
+	poka::work work;
+	poka::output offline;
+	REQUIRE(poka::autocorrelation<Mode>(&work, cbs, in.size(), depth, SR, &offline) == poka::result::ok);
+	std::vector<float> streamed;
+	const auto emit = [&streamed](size_t beg, const float* sizes, size_t count) {
+		REQUIRE(beg == streamed.size());
+		streamed.insert(streamed.end(), sizes, sizes + count);
+	};
+	auto s = poka::make_stream<Mode>(depth, SR);
+	for (size_t beg = 0; beg < in.size(); beg += chunk_size) {
+		poka::push(&s, in.data() + beg, std::min(chunk_size, in.size() - beg), emit);
+	}
+	poka::finish(&s, emit);
+	REQUIRE(streamed.size() == offline.frames.estimated_size.size());
+	auto max_error = 0.0f;
+	for (size_t i = 0; i < streamed.size(); i++) {
+		max_error = std::max(max_error, std::abs(streamed[i] - offline.frames.estimated_size[i]));
+	}
+	INFO("depth " << depth << ", chunk size " << chunk_size);
+	// Only the rounding in the smoothing sums can differ
+	REQUIRE(max_error < 0.001f);
+}
+
+} // namespace
+
+TEST_CASE("poka stream matches the whole-file analysis") {
+	constexpr auto SR = size_t(44100);
+	const auto in = make_glide(SR, SR * 3);
+	for (const auto depth : {size_t(0), size_t(1), size_t(2), size_t(8)}) {
+		for (const auto chunk_size : {size_t(512), size_t(100000)}) {
+			check_stream_matches_offline<snd::poka::mode::milestones>(in, SR, depth, chunk_size);
+			check_stream_matches_offline<snd::poka::mode::classic>(in, SR, depth, chunk_size);
+		}
+	}
+}
+
+namespace {
+
+template <snd::poka::mode Mode>
+auto check_pool_matches_serial(const std::vector<float>& in, size_t SR, snd::th::thread_pool* pool) -> void {
+	using namespace snd;
+	const auto get_frames = [&in](size_t beg, size_t count, float* out) {
+		std::copy(in.begin() + beg, in.begin() + beg + count, out);
+	};
+	const auto cbs = poka::make_cbs(get_frames, [](float) {}, [] { return false; });
+	poka::work serial_work;
+	poka::work pooled_work;
+	poka::output serial;
+	poka::output pooled;
+	REQUIRE(poka::autocorrelation<Mode>(&serial_work, cbs, in.size(), 8, SR, &serial) == poka::result::ok);
+	REQUIRE(poka::autocorrelation<Mode>(&pooled_work, cbs, in.size(), 8, SR, &pooled, pool) == poka::result::ok);
+	// Enough cycles for several chunks
+	REQUIRE(serial_work.cycle_best_match.size() > 4 * snd::poka::detail::PARALLEL_CYCLE_CHUNK_SIZE);
+	REQUIRE(pooled_work.cycle_best_match == serial_work.cycle_best_match);
+	REQUIRE(pooled.frames.estimated_size == serial.frames.estimated_size);
+}
+
+} // namespace
+
+TEST_CASE("poka scores cycles the same on a thread pool") {
+	constexpr auto SR = size_t(44100);
+	const auto in = make_glide(SR, SR * 3);
+	snd::th::thread_pool pool{3};
+	check_pool_matches_serial<snd::poka::mode::milestones>(in, SR, &pool);
+	check_pool_matches_serial<snd::poka::mode::classic>(in, SR, &pool);
+}
+
+TEST_CASE("fudge bank renders the same on any number of threads") {
+	using namespace snd;
+	constexpr auto VOICES = size_t(12);
+	std::mt19937 rng(1);
+	std::uniform_real_distribution<float> noise(-1.0f, 1.0f);
+	std::array<std::vector<float>, 2> sample;
+	for (auto& channel : sample) {
+		channel.resize(20000);
+		for (auto& value : channel) {
+			value = noise(rng);
+		}
+	}
+	const auto read = [&sample](size_t, int channel, const float* positions, size_t count, float* out) {
+		const auto& data = sample[size_t(channel)];
+		for (size_t i = 0; i < count; i++) {
+			const auto index = size_t(std::max(0.0f, positions[i]));
+			out[i] = index + 1 < data.size() ? snd::lerp(data[index], data[index + 1], positions[i] - float(index)) : 0.0f;
+		}
+	};
+	std::vector<fudge::vector_info> info(VOICES);
+	fudge::bank_block<VOICES> block;
+	for (size_t v = 0; v < VOICES; v++) {
+		auto& voice = info[v];
+		for (int i = 0; i < kFloatsPerDSPVector; i++) {
+			voice.amp.value[i]             = 0.5f;
+			voice.ff.value[i]              = 1.0f + (0.25f * float(v % 3));
+			voice.harmonic_ratio.value[i]  = 1.0f;
+			voice.size.value[i]            = 100.0f + (37.0f * float(v));
+			voice.uniformity.value[i]      = 1.0f;
+			voice.sample_position.value[i] = snd::frame_pos{double(500 * v)};
+		}
+		voice.channel_count      = {2};
+		voice.channel_mode       = fudge::channel_mode::stereo;
+		voice.frame_increment    = {1.0f};
+		voice.sample_frame_count = {sample[0].size()};
+		voice.SR                 = {48000};
+		// One voice is left paused
+		block.info[v] = v == 5 ? nullptr : &voice;
+		for (auto& flags : block.flags[v].value) {
+			flags.value = fudge::frame_flags::play;
+		}
+	}
+	// The same voices in every bank, with one left unused
+	std::array<std::unique_ptr<fudge::bank<VOICES>>, 4> banks;
+	for (auto& b : banks) {
+		b = std::make_unique<fudge::bank<VOICES>>();
+		for (size_t v = 0; v < VOICES; v++) {
+			(void)fudge::allocate(b.get());
+		}
+		fudge::release(b.get(), 7);
+	}
+	th::realtime_pool serial{0};
+	th::realtime_pool parallel{3, 100};
+	auto single_voice_chunks = audio::voices::make_renderer<2>(VOICES);
+	auto serial_chunks       = audio::voices::make_renderer<2>(VOICES, 4);
+	auto parallel_chunks     = audio::voices::make_renderer<2>(VOICES, 4);
+	auto heard = false;
+	for (int vector = 0; vector < 100; vector++) {
+		const auto expected = fudge::render(banks[0].get(), block, read);
+		const auto out_1    = fudge::render(banks[1].get(), block, &single_voice_chunks, &parallel, read);
+		const auto out_2    = fudge::render(banks[2].get(), block, &serial_chunks, &serial, read);
+		const auto out_3    = fudge::render(banks[3].get(), block, &parallel_chunks, &parallel, read);
+		for (int row = 0; row < 2; row++) {
+			for (int i = 0; i < kFloatsPerDSPVector; i++) {
+				// With one voice per chunk the voices are summed in the
+				// same order as render()
+				REQUIRE(out_1.constRow(row)[i] == expected.constRow(row)[i]);
+				REQUIRE(out_3.constRow(row)[i] == out_2.constRow(row)[i]);
+				REQUIRE(out_3.constRow(row)[i] == doctest::Approx(expected.constRow(row)[i]).epsilon(1e-5));
+				heard = heard || expected.constRow(row)[i] != 0.0f;
+			}
+		}
+	}
+	REQUIRE(heard);
+}
+
+TEST_CASE("fudge cloud grains add up to a constant level") {
+	using namespace snd;
+	const auto read_sample  = [](int, float) { return 1.0f; };
+	const auto read_samples = [](int, const float*, size_t count, float* out) {
+		std::fill(out, out + count, 1.0f);
+	};
+	fudge::vector_flags flags;
+	for (auto& f : flags.value) {
+		f.value = fudge::frame_flags::play;
+	}
+	for (const auto size : {300.0f, 1000.0f}) {
+		for (const auto density : {1, 2, 3, 4, 6}) {
+			fudge::vector_info v;
+			for (int i = 0; i < kFloatsPerDSPVector; i++) {
+				v.amp.value[i]             = 1.0f;
+				v.ff.value[i]              = 1.0f;
+				v.harmonic_ratio.value[i]  = 1.0f;
+				v.size.value[i]            = size;
+				v.uniformity.value[i]      = 1.0f;
+				v.sample_position.value[i] = snd::frame_pos{1000.0};
+			}
+			v.channel_count      = {1};
+			v.frame_increment    = {1.0f};
+			v.sample_frame_count = {100000};
+			v.SR                 = {48000};
+			fudge::cloud<8> frame_cloud;
+			fudge::cloud<8> vector_cloud;
+			frame_cloud.density  = size_t(density);
+			vector_cloud.density = size_t(density);
+			// The first grain waits for the default size and the
+			// level builds up over the next few
+			const auto settled = 4 * int(size) + 1024;
+			for (int vector = 0; vector < 100; vector++) {
+				const auto out = fudge::process(&vector_cloud, v, flags, read_samples);
+				for (int i = 0; i < kFloatsPerDSPVector; i++) {
+					const auto expected = fudge::process(&frame_cloud, v, fudge::frame_info{flags.value[i], i}, read_sample);
+					REQUIRE(out.constRow(0)[i] == expected.L);
+					if ((vector * kFloatsPerDSPVector) + i >= settled) {
+						REQUIRE(expected.L == doctest::Approx(1.0f).epsilon(1e-4));
+					}
+				}
+			}
+		}
+	}
+}